@@ -1,37 +1,172 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-struct entity;
-struct maze;
+#include "game.h" // for direction, game, location
 
-// Initialize nCurses context
-void draw_init(void);
+// What the input of a renderer returns once there is no more of it
+#define DRAW_EOF (-1)
 
-// Destroy nCurses context
+// Where the view of the maze goes on the screen
+#define DRAW_X_OFF 5
+#define DRAW_Y_OFF 5
+
+/* What a frame shows, taken from the game by draw_show()
+ *
+ * A scene holds its own copy of what the player sees, it is drawn while the
+ * game goes on: the cells of the maze in the square of the field of view,
+ * (width) x (height) of them from (origin), blank where they are not seen,
+ * and the trolls on them.
+ */
+struct draw_scene
+{
+  uint64_t taken; // ns, when it was taken
+  uint32_t maze_width;
+  uint32_t maze_height;
+
+  struct location player;
+  enum direction face;
+
+  struct location origin;
+  uint32_t width;
+  uint32_t height;
+  char* cells;
+  size_t cell_capacity;
+
+  uint32_t num_trolls;
+  uint32_t troll_capacity;
+  struct location* trolls;
+};
+
+/* A way of putting the game on a screen
+ *
+ * Every frame is made by calling begin_frame, maze, entities and end_frame in
+ * that order, on the render thread; input waits for the next key on the
+ * thread of the game. Renderers keep what they need of a frame between the
+ * calls, nothing is drawn on the screen before end_frame.
+ */
+struct renderer
+{
+  const char* name;
+
+  void (*init)(void);
+  void (*cleanup)(void);
+
+  // Start a frame of the part of the maze around the player of (scene) that
+  // fits the screen
+  void (*begin_frame)(const struct draw_scene* scene);
+  // The cells of the maze the player sees
+  void (*maze)(const struct draw_scene* scene);
+  // The trolls the player sees and the player
+  void (*entities)(const struct draw_scene* scene);
+  // Put the frame on the screen
+  void (*end_frame)(void);
+
+  // Returns the next key from the user, DRAW_EOF if there is none to come
+  // This must not touch the screen, which belongs to the render thread.
+  int (*input)(void);
+  // Tell the player the game is lost, over the last frame
+  void (*game_over)(void);
+};
+
+// The backends, see src/draw_ncurses.c, src/draw_ansi.c and src/draw_null.c
+extern const struct renderer draw_ncurses;
+extern const struct renderer draw_ansi;
+extern const struct renderer draw_null;
+
+// Returns the renderer called (name), NULL if there is none
+const struct renderer* draw_renderer(const char* name);
+
+// What drawing has cost so far
+struct draw_stats
+{
+  uint64_t frames;
+  uint64_t ns;    // from begin_frame to the end of end_frame
+  uint64_t cells; // cells sent to the terminal
+  uint64_t runs;  // runs of consecutive cells they were sent in
+  uint64_t bytes; // bytes written to the terminal, where the renderer knows
+  uint64_t moves; // times the camera moved
+
+  uint64_t dropped;     // scenes replaced before they were drawn
+  uint64_t latency_ns;  // from taking the scenes to their frames on screen
+  uint64_t latency_max; // ns
+};
+
+/* Drawing happens on a render thread of its own
+ *
+ * draw_show() hands scenes over to it through a triple buffer: the game fills
+ * one scene while the render thread draws another, and the third holds the
+ * latest scene handed over. Handing one over is an atomic exchange, and the
+ * game never waits on the terminal; a scene the render thread did not get to
+ * before the next one is dropped.
+ */
+
+// Set up (renderer) and start the render thread
+void draw_init(const struct renderer* renderer);
+
+// Take a scene of (game) as the player sees it and hand it to the render
+// thread, without waiting for it to be drawn
+void draw_show(const struct game* game);
+
+// Draw the last scene handed over, if it was not yet, and stop the render
+// thread, after which the renderer may be used from the calling thread
+void draw_stop(void);
+
+// Stop the render thread and clean up the renderer draw_init() set up
 void draw_cleanup(void);
 
-// FIXME, game over screen
-void draw_game_over(void);
+// Returns what drawing has cost so far, once the render thread stopped
+struct draw_stats draw_stats(void);
 
-// Simple wrapper to keep the nCurses functions in the draw.c file
-// Returns the next character from the user
-int draw_getch(void);
+// Returns the next key read from standard input, DRAW_EOF at its end
+int draw_read_key(void);
 
-/* Draw functions
- * These should be called in this order to update the screen
+/* The frame, shared by the renderers that draw on a terminal
+ *
+ * A frame is a window of the maze as large as the screen allows, its camera
+ * follows the player: it stays put until the player comes within a quarter
+ * of the window of an edge, then centers on the player again. Composing a
+ * frame costs in proportion to the window, whatever the size of the maze.
+ *
+ * The scene is composed into the next frame; end_frame sends the runs of
+ * cells that differ from what the terminal has on it, and the status line if
+ * it changed. Nothing is cleared or repainted as a whole, so a frame in which
+ * the player took a step costs a handful of cells.
  *
- * Be sure to initialize the screen with draw_init() before using these
- * functions
+ * A cell holds its character in the low byte and its color above.
  */
+enum draw_color
+{
+  DRAW_PLAIN = 0,
+  DRAW_PLAYER,
+  DRAW_TROLL,
+};
+
+#define DRAW_CELL(ch, color) ((uint16_t)((uint8_t)(ch) | (color) << 8))
+#define DRAW_CELL_CHAR(cell) ((char)((cell)&0xff))
+#define DRAW_CELL_COLOR(cell) ((enum draw_color)((cell) >> 8))
+
+// Start a frame of the part of the maze around the player of (scene) that
+// fits a screen of (columns) x (lines)
+// Returns true if the frame starts from a blank screen, which the renderer
+// then has to clear.
+bool draw_frame_begin(const struct draw_scene* scene, uint32_t columns,
+                      uint32_t lines);
+
+// Compose the maze and the entities of (scene) into the next frame
+void draw_frame_maze(const struct draw_scene* scene);
+void draw_frame_entities(const struct draw_scene* scene);
 
-// Draw the maze (p_maze) to the screen
-void draw_maze(const struct maze* p_maze);
+// Calls (emit) for each run of (count) cells from (x, y) of the frame that
+// changed since the last one, which are then taken as shown
+void draw_frame_runs(void (*emit)(void* ctx, uint32_t x, uint32_t y,
+                                  const uint16_t* cells, uint32_t count),
+                     void* ctx);
 
-// Draw the trolls to the screen
-// Takes pointer to entity (trolls)
-void draw_trolls(const struct entity* troll);
+// Returns the status line if it changed since the last frame, NULL otherwise
+const char* draw_frame_status(void);
 
-// Draw the player to the screen
-// Takes a pointer (p_player) to the player entity
-void draw_player(const struct entity* p_player);
+// Count (bytes) written to the terminal for the frame in the stats
+void draw_frame_sent(uint64_t bytes);
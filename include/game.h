@@ -2,9 +2,9 @@
 
 #include <stdbool.h> // for bool
 #include <stddef.h>  // for size_t
-#include <stdint.h>  // for uint32_t, uint8_t
+#include <stdint.h>  // for uint32_t, uint16_t, uint8_t
+#include <stdio.h>   // for FILE
 
-#define MAZE_XY(M, X, Y) ((M)->maze[(M)->maze_width * (Y) + (X)])
 #define LEN(X) (sizeof(X) / sizeof(*X))
 
 enum direction
@@ -21,6 +21,16 @@ struct location
   uint32_t y;
 };
 
+/* A pseudo-random number generator, see src/rng.c
+ *
+ * Every game draws from its own, so that games running side by side, on one
+ * thread or many, do not change each other's numbers.
+ */
+struct rng
+{
+  uint64_t state[4];
+};
+
 struct path
 {
   size_t next; // index into the steps array indicating the next move
@@ -33,13 +43,206 @@ struct entity
   enum direction face;
   struct location loc;
   struct path* path;
+  struct occupancy* occupancy; // counts the entity on its cell, or NULL
+};
+
+/* How the cells of a maze are ordered in maze->maze
+ *
+ * MAZE_LINEAR is row-major, (x, y) is at maze_width * y + x.
+ *
+ * MAZE_TILED groups the cells in 8x8 tiles of 64 bytes, one cache line each,
+ * so the cells above and below are usually in the same line. The tiles are
+ * stored in Z-order (Morton order), which keeps neighbouring tiles close
+ * together in memory as well. The tile grid is padded with walls to a power
+ * of two in each direction.
+ */
+enum maze_layout
+{
+  MAZE_LINEAR,
+  MAZE_TILED,
 };
 
+// Counters of a paged maze, see src/maze_pager.c
+struct maze_pager_stats
+{
+  uint64_t faults;    // chunks mapped in
+  uint64_t evictions; // chunks unmapped to make room
+  uint64_t failures;  // chunks that could not be mapped, read as walls
+  uint32_t resident;  // chunks currently mapped
+};
+
+// Largest width or height of a maze, so that every cell of a maze has a
+// 32-bit cell id (see maze_cell_id())
+#define MAZE_MAX_SIDE 65535
+
+// One change made to a maze by maze_set_cell()
+struct maze_change
+{
+  uint32_t cell; // cell id
+  char old_cell;
+  char new_cell;
+};
+
+// Number of changes kept in the journal of a maze
+#define MAZE_JOURNAL_LENGTH 1024
+
 struct maze
 {
-  char* maze;
+  char* maze; // NULL for paged mazes, read those through maze_cell()
   uint32_t maze_width;
   uint32_t maze_height;
+
+  // Cell ordering of maze->maze; only use maze_cell()/maze_index() to access it
+  enum maze_layout layout;
+  size_t* col_offset; // MAZE_TILED only, see maze_index()
+  size_t* row_offset;
+
+  uint32_t* exits; // cell id of every 'X' cell, in increasing order
+  uint32_t num_exits;
+
+  // Number of changes made with maze_set_cell(), and a ring buffer of the
+  // last MAZE_JOURNAL_LENGTH of them (allocated by the first change)
+  uint64_t generation;
+  struct maze_change* journal;
+
+  // Distance to the nearest wall in each direction of every cell, at
+  // 4 * maze_index() + direction, or NULL if not built (see src/maze_rays.c)
+  uint16_t* rays;
+
+  // Connected region label of each cell id (0 for walls), or NULL if unknown
+  uint32_t* components;
+
+  // Set when the maze was loaded with maze_map(): the fields above point into
+  // this mapping of the binary maze file instead of separate allocations
+  void* mapping;
+  size_t mapping_len;
+
+  // Set when the maze was loaded with maze_map_paged(): the cells are mapped
+  // in on demand by the pager
+  struct maze_pager* pager;
+
+  // Set by maze_share(): everything above belongs to this maze, which must
+  // stay as it is for as long as it is shared
+  const struct maze* shared;
+};
+
+// Returns the cell at position (index) of a paged maze, see src/maze_pager.c
+// Cells the pager cannot map in read as walls, see maze_pager_stats().
+char maze_pager_cell(struct maze_pager*, size_t index);
+
+/* Cells visible from a point within a radius, see src/fov.c
+ *
+ * (visible) is a bitmap of the (2 * radius + 1) square centred on (origin),
+ * read it through fov_visible().
+ */
+struct fov
+{
+  uint32_t radius;
+  struct location origin;
+  uint64_t generation; // maze->generation the view was computed at
+  bool valid;          // false until the first fov_update()
+  uint8_t* visible;
+};
+
+/* Number of entities on each cell of a maze, see src/occupancy.c
+ *
+ * Small mazes use (grid), a counter per cell id. Large ones, and shared ones
+ * until they fill up, use a hash table of the occupied cells: (keys) and
+ * (counts) have (mask) + 1 slots, (used) of them hold a cell.
+ */
+struct occupancy
+{
+  uint32_t width;
+  uint32_t grid_cells; // cells of the grid to switch to, 0 for none
+  uint32_t* grid;
+
+  uint32_t* keys;
+  uint32_t* counts;
+  uint32_t mask;
+  uint32_t used;
+};
+
+/* Trolls asleep until a later tick, see trolls_update_all()
+ *
+ * A troll waking on tick t sleeps in slots[t & (num_slots - 1)], along with
+ * the others waking on the same tick. (awake) lists the trolls to update on
+ * the next tick. It is all thrown away, and every troll woken, whenever it
+ * might no longer be right: see trolls_wheel_valid().
+ */
+struct trolls_slot
+{
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t* which;
+};
+
+struct trolls_wheel
+{
+  bool valid; // false after trolls are added or removed
+  uint64_t tick;
+  struct location focus;
+  uint32_t lod_radius;
+  uint32_t lod_period;
+
+  uint32_t num_slots; // a power of two, more than the longest sleep
+  struct trolls_slot* slots;
+  struct trolls_slot awake;
+};
+
+/* The trolls of a game, stored as a structure of arrays, see src/troll.c
+ *
+ * The troll at index i (< count) is at loc[i], facing face[i] and following
+ * path[i]. Indexes change as trolls are removed; handles do not, look them up
+ * with trolls_index().
+ */
+struct trolls
+{
+  uint32_t count;
+  uint32_t capacity;
+
+  struct location* loc;
+  enum direction* face;
+  struct path** path; // NULL when the troll has no path
+
+  uint32_t* handle; // handle of the troll at each index
+  uint32_t* index;  // index of the troll with each handle
+  uint32_t num_handles;
+
+  struct occupancy occupancy; // number of trolls on each cell
+
+  // Working memory of trolls_update_all(), kept from one tick to the next
+  uint32_t plan_capacity;
+  uint32_t* plan_which;
+  struct location* plan_targets;
+  struct path** plan_paths;
+  uint64_t* plan_keys;
+  struct trolls_wheel wheel;
+};
+
+enum trolls_order
+{
+  TROLLS_ROUND_ROBIN,
+  TROLLS_NEAREST_FIRST,
+};
+
+/* How trolls_update_all() spreads the work of the trolls over ticks
+ *
+ * A troll that has no path to follow asks for one. At most (budget) trolls
+ * are served each tick, in (order); the others walk on the way they face and
+ * ask again the next tick.
+ *
+ * Trolls further than (lod_radius) cells from (focus) in x or y are only
+ * updated every (lod_period) ticks, and then take up to (lod_period) steps at
+ * once.
+ */
+struct trolls_schedule
+{
+  uint32_t budget; // path searches per tick, 0 for no limit
+  enum trolls_order order;
+  uint32_t lod_radius;
+  uint32_t lod_period;   // 0 or 1 to update every troll every tick
+  struct location focus; // where the player is
+  uint64_t tick;         // TROLLS_ROUND_ROBIN and lod_period move on with it
 };
 
 enum game_state
@@ -49,18 +252,144 @@ enum game_state
   GAME_LOSE,
 };
 
+// What the allocators of src/pool.c hand out
+enum pool_kind
+{
+  POOL_ENTITY,  // struct entity
+  POOL_PATH,    // struct path
+  POOL_STEPS,   // the steps of a path
+  POOL_SCRATCH, // working memory of path searches and troll updates
+  POOL_KINDS,
+};
+
+struct pool_stats
+{
+  uint64_t allocs; // objects handed out
+  uint64_t frees;  // objects given back
+  uint64_t system; // allocations made from the system to hand them out
+};
+
+// A slice [begin, end) of a parallel loop, see job_pool_for()
+typedef void (*job_fn)(void* ctx, size_t begin, size_t end);
+
 struct game
 {
   uint8_t player_vision;
+  struct fov vision; // cells the player can see
   struct entity* player;
 
-  uint8_t num_trolls;
-  struct entity** trolls;
+  // Where the player stepped from this tick, and the handles of the trolls on
+  // the cell it stepped onto before they moved, see game_get_status()
+  struct location player_from;
+  uint32_t* crossing;
+  uint32_t num_crossing;
+  uint32_t crossing_capacity;
+
+  struct trolls trolls;
 
   struct maze maze;
   enum game_state state;
+
+  // Threads the trolls plan their paths on, NULL to do it all serially
+  struct job_pool* jobs;
+
+  // How many trolls plan a path each tick, and which
+  struct trolls_schedule schedule;
+
+  // Random numbers are drawn from (rng), seeded anew each tick from (seed)
+  // and (tick), so a game can be picked up again at any tick
+  struct rng rng;
+  uint32_t seed;
+  uint64_t tick; // number of ticks run so far
+};
+
+/* Games ready to be played on one shared maze, see game_pool_get()
+ *
+ * A game given back is reset and handed out again, so starting a new match
+ * does not allocate. A pool is not thread-safe: give every thread its own.
+ */
+struct game_pool
+{
+  const struct maze* maze;
+  struct game** games; // the games ready to be handed out
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t num_made; // games made because none was ready
+};
+
+// Everything a game changes as it runs, see src/checkpoint.c
+struct game_checkpoint
+{
+  uint64_t tick;
+  enum game_state state;
+  struct location player_loc;
+  enum direction player_face;
+  struct trolls trolls; // without occupancy counts
+};
+
+// Writes a recording of the keys pressed in a game, see src/record.c
+struct recorder
+{
+  FILE* file;
+  unsigned char key; // key of the current run
+  uint64_t run;      // number of ticks in the current run, not written yet
+  int ok;            // 0 once a write failed
+};
+
+// A recording loaded back, with the key of every tick
+struct recording
+{
+  uint32_t seed;
+  uint32_t num_trolls;
+  uint32_t budget; // see struct trolls_schedule
+  enum trolls_order order;
+  uint32_t lod_radius;
+  uint32_t lod_period;
+  char* maze_path; // NULL for the built-in maze
+  size_t num_ticks;
+  unsigned char* keys;
 };
 
+// Returns the cell id of (loc): its row-major position in the maze
+// Cell ids do not depend on the layout, they are the compact key to use for
+// anything stored per cell outside of the maze itself.
+static inline uint32_t
+maze_cell_id(const struct maze* maze, struct location loc)
+{
+  return maze->maze_width * loc.y + loc.x;
+}
+
+// Returns the location of the cell with id (cell)
+static inline struct location
+maze_cell_loc(const struct maze* maze, uint32_t cell)
+{
+  return (struct location){.x = cell % maze->maze_width,
+                           .y = cell / maze->maze_width };
+}
+
+// Returns the position of the cell (x, y) in maze->maze
+static inline size_t
+maze_index(const struct maze* maze, uint32_t x, uint32_t y)
+{
+  if (maze->layout == MAZE_LINEAR)
+    return (size_t)maze->maze_width * y + x;
+
+  // The offsets of the column and of the row use disjoint bits of the index
+  return maze->col_offset[x] + maze->row_offset[y];
+}
+
+// Returns the contents of the cell (x, y): '#', ' ' or 'X'
+static inline char
+maze_cell(const struct maze* maze, uint32_t x, uint32_t y)
+{
+  const size_t index = maze_index(maze, x, y);
+
+  if (maze->pager)
+    return maze_pager_cell(maze->pager, index);
+
+  return maze->maze[index];
+}
+
 // Returns the real distance between the two locations
 double location_distance(struct location, struct location);
 
@@ -72,6 +401,84 @@ bool location_adjacent(struct location, struct location);
 // Returns false If (l2) is not adjacent to (l1)
 bool location_relative(struct location l1, struct location l2, enum direction*);
 
+// Returns the location one step from (loc) in the direction
+struct location location_step(struct location loc, enum direction);
+
+// Start (rng) on the sequence of (seed)
+void rng_seed(struct rng*, uint64_t seed);
+
+// Returns the next 64 random bits
+uint64_t rng_next(struct rng*);
+
+// Returns a random number in [0, bound)
+uint32_t rng_below(struct rng*, uint32_t bound);
+
+// Fill (values) with (count) random numbers in [0, bound), cheaper than
+// calling rng_below() (count) times
+void rng_fill_below(struct rng*, uint32_t* values, size_t count,
+                    uint32_t bound);
+
+// Set up an empty field of view of radius (radius)
+void fov_init(struct fov*, uint32_t radius);
+
+void fov_destroy(struct fov*);
+
+// Compute the cells of the maze visible from (origin) by shadowcasting
+// Returns false, without doing anything, if neither (origin) nor the maze
+// changed since the last update
+bool fov_update(struct fov*, const struct maze*, struct location origin);
+
+// Returns true if (loc) was visible at the last fov_update()
+bool fov_visible(const struct fov*, struct location loc);
+
+// Set up empty occupancy counts for the cells of (maze)
+void occupancy_init(struct occupancy*, const struct maze*);
+
+void occupancy_destroy(struct occupancy*);
+
+// Returns the number of entities on (loc), which must be within the maze
+uint32_t occupancy_count(const struct occupancy*, struct location loc);
+
+// Count an entity in or out of (loc)
+void occupancy_add(struct occupancy*, struct location loc);
+void occupancy_remove(struct occupancy*, struct location loc);
+
+// Move one entity from (from) to (to)
+void occupancy_move(struct occupancy*, struct location from,
+                    struct location to);
+
+// Start a work stealing pool of (num_threads) threads, including the caller
+// Returns NULL for fewer than 2 threads; job_pool_for() then runs serially
+struct job_pool* job_pool_new(uint32_t num_threads);
+
+void job_pool_delete(struct job_pool**);
+
+// Returns the number of threads of the pool, 1 without one
+uint32_t job_pool_threads(const struct job_pool*);
+
+// Run (fn) over [0, count) in slices of at most (grain) on the pool's threads
+// and wait for all of them
+void job_pool_for(struct job_pool*, size_t count, size_t grain, job_fn fn,
+                  void* ctx);
+
+// Get and give back an object of the fixed-size pool (kind), POOL_ENTITY or
+// POOL_PATH; objects come zeroed
+void* pool_get(enum pool_kind kind);
+void pool_put(enum pool_kind kind, void* object);
+
+// Get a buffer of (num_steps) steps, NULL for 0, and give it back
+// The buffer may be given back for fewer steps than it was taken for, never
+// more.
+enum direction* pool_get_steps(size_t num_steps);
+void pool_put_steps(enum direction* steps, size_t num_steps);
+
+// Count an allocation from the system of (kind) that did not go through
+// pool_get() or pool_get_steps()
+void pool_count_system(enum pool_kind kind);
+
+// Returns the allocation counters of (kind), from the start of the program
+struct pool_stats pool_stats(enum pool_kind kind);
+
 // Allocate a new entity
 struct entity* entity_new(void);
 
@@ -90,21 +497,97 @@ int entity_new_path(const struct maze*, struct entity*, struct location);
 // Returns the number of empty space in the given direction
 int entity_look(const struct maze*, const struct entity*, enum direction);
 
-// Load the maze in (str) of length (len) into memory
+// Load the maze text in (str) of length (len) into memory
+// Rows are separated by newlines, the width and height are taken from the text
 int maze_load(struct maze*, const char* str, size_t len);
+
+// Load a maze from a stream or a text file, in the same format as maze_load()
+int maze_load_stream(struct maze*, FILE*);
+int maze_load_file(struct maze*, const char* path);
+
+// Map a binary maze file into memory, zero-copy (see src/maze_bin.c)
+int maze_map(struct maze*, const char* path);
+
+// Open a binary maze file, keeping at most (max_chunks) chunks of it mapped
+// Use this for mazes that do not fit in memory, ideally in the tiled layout.
+int maze_map_paged(struct maze*, const char* path, uint32_t max_chunks);
+
+// Returns the paging counters of a maze opened with maze_map_paged()
+struct maze_pager_stats maze_pager_stats(const struct maze_pager*);
+
+struct maze_pager* maze_pager_new(int fd, uint64_t cells_offset,
+                                  size_t cells_size, uint32_t max_resident);
+void maze_pager_delete(struct maze_pager**);
+
+// Save the maze in the binary format
+// Returns 0 for paged mazes, their file already is in the binary format
+int maze_save(const struct maze*, const char* path);
+
+// Open a maze file that is either in the binary or the text format
+int maze_open(struct maze*, const char* path);
+
+// Compute the connected region of each open cell into maze->components
+void maze_label_components(struct maze*);
+
+// Build the wall distance tables used by entity_look()
+void maze_build_rays(struct maze*);
+
+// Patch the wall distance tables after the cell at (loc) changed to or from a
+// wall
+void maze_update_rays(struct maze*, struct location loc);
+
+// Change a cell of the maze, recording the change in the journal
+int maze_set_cell(struct maze*, uint32_t x, uint32_t y, char cell);
+
+// Returns the change that brought the maze to (generation), NULL if it is no
+// longer in the journal
+const struct maze_change* maze_journal_get(const struct maze*,
+                                           uint64_t generation);
+
+// Returns true if the (num_exits) exits are cells of a (width) x (height)
+// maze in increasing order, as maze->exits must be; loaders check the exits
+// they read with it
+bool maze_exits_valid(uint32_t width, uint32_t height, const uint32_t* exits,
+                      uint32_t num_exits);
+
+// Returns true if (ptr) points into the mapping the maze was loaded from,
+// rather than to memory of its own
+bool maze_mapped(const struct maze*, const void* ptr);
+
+// Returns the number of bytes in maze->maze, including any padding
+size_t maze_size(const struct maze*);
+
+// Set up maze_index() for (layout), without moving any cells
+void maze_init_layout(struct maze*, enum maze_layout);
+
+// Reorder the cells of the maze into (layout)
+// Returns 0 for mapped and paged mazes, whose layout is fixed by the file
+int maze_set_layout(struct maze*, enum maze_layout);
+
 void maze_destroy(struct maze*);
 
+// Make (maze) a read-only view of (src), which many games can play on at
+// once. (maze) cannot be changed, and destroying it leaves (src) alone.
+// Returns 0 for paged mazes: the pager cannot be used from several threads.
+int maze_share(struct maze* maze, const struct maze* src);
+
 // Return a random empty location on the maze
-struct location maze_find_empty_location(const struct maze*);
+struct location maze_find_empty_location(const struct maze*, struct rng*);
+
+// Return a random empty location within (radius) cells of (center), reachable
+// from it if the maze knows its components
+struct location maze_find_empty_location_near(const struct maze*, struct rng*,
+                                              struct location center,
+                                              uint32_t radius);
 
 // spawn the entity randomly on an empty location in the maze
-int maze_random_spawn(const struct maze*, struct entity*);
+int maze_random_spawn(const struct maze*, struct rng*, struct entity*);
 
 // Returns true if the specified direction from the entity is empty
 bool maze_is_empty_space(const struct maze*, struct entity*, enum direction);
 
 // Returns true if the value (val) in direction is within range
-bool maze_check_bound(const struct maze*, uint16_t val, enum direction);
+bool maze_check_bound(const struct maze*, uint32_t val, enum direction);
 
 // Returns true if the coordinate in location is empty space
 bool maze_is_empty_space_loc(const struct maze*, struct location);
@@ -113,11 +596,103 @@ bool maze_is_empty_space_loc(const struct maze*, struct location);
 bool maze_check_bound_loc(const struct maze*, struct location);
 
 // Allocate memory and initialize new game structure
-struct game* game_new(void);
+// The maze is loaded from the maze file at (maze_path), or the built-in maze
+// is used if (maze_path) is NULL. Everything random about the game, from where
+// the trolls start on, follows from (seed).
+// Returns NULL if the maze file cannot be loaded
+struct game* game_new(const char* maze_path, uint32_t seed);
+
+// Same as game_new(), on a view of (maze) shared with other games, see
+// maze_share(). Build the rays of (maze) first if the games need them.
+// Returns NULL if (maze) cannot be shared
+struct game* game_new_shared(const struct maze* maze, uint32_t seed);
 
 // Free game memory
 void game_delete(struct game*);
 
+// Start (game) over as game_new() would have made it with (seed), on the same
+// maze, keeping all its memory. Its threads and schedule stay as they were.
+void game_reset(struct game*, uint32_t seed);
+
+// Set up an empty pool of games on (maze), shared by all of them
+void game_pool_init(struct game_pool*, const struct maze* maze);
+
+// Delete the games in the pool
+void game_pool_destroy(struct game_pool*);
+
+// Returns a game as game_new_shared() would make it with (seed), reusing one
+// of the pool if it has one
+// Returns NULL if the maze of the pool cannot be shared
+struct game* game_pool_get(struct game_pool*, uint32_t seed);
+
+// Give (game), from game_pool_get(), back to the pool
+void game_pool_put(struct game_pool*, struct game*);
+
+// Add or remove trolls until there are (count) of them
+void game_set_trolls(struct game*, uint32_t count);
+
+// Start the next tick: seed game->rng for it
+// game_tick() does this, call it when running the phases one by one
+void game_begin_tick(struct game*);
+
+// Put the player on a random empty location, without a troll if one is found
+void game_spawn_player(struct game*);
+
+// Move the player for the key (key), one of w/a/s/d (any case)
+// Other keys leave the player where it is
+void game_update_player(struct game*, int32_t key);
+
+// Move every troll one step, planning paths on game->jobs
+void game_update_trolls(struct game*);
+
+// Let at most (budget) trolls plan a path each tick, 0 for no limit, served
+// in (order); TROLLS_NEAREST_FIRST serves the ones near the player first
+void game_set_schedule(struct game*, uint32_t budget, enum trolls_order order);
+
+// Update the trolls further than (radius) cells from the player only every
+// (period) ticks, (period) steps at a time; 0 or 1 updates all every tick
+void game_set_lod(struct game*, uint32_t radius, uint32_t period);
+
+// Plan troll paths on (num_threads) threads from now on
+// The game plays out the same with any number of threads.
+void game_set_threads(struct game*, uint32_t num_threads);
+
+// Advance the game by one tick: the player moves for (key), then the trolls
+// move, then the status of the game is updated. Everything that happens
+// depends only on the state of the game and (key).
+void game_tick(struct game*, int32_t key);
+
+// If the game is over, put the player back on the maze to keep it going
+// Returns the state the game was in
+enum game_state game_continue(struct game*);
+
+// Returns a hash of the tick, the player and the trolls, to check that two
+// runs of a game played out the same
+uint64_t game_hash(const struct game*);
+
+// Copy the changing state of the game into (cp), and back
+// A game restored to a checkpoint plays on exactly as it did from there.
+void game_checkpoint_save(const struct game*, struct game_checkpoint* cp);
+void game_checkpoint_restore(struct game*, const struct game_checkpoint* cp);
+void game_checkpoint_free(struct game_checkpoint*);
+
+// Save the whole state of the game to (path), and load it back into a new
+// game (see src/snapshot.c)
+int game_snapshot_save(const struct game*, const char* path);
+struct game* game_snapshot_load(const char* path);
+
+// Record the keys of a game to (path) (see src/record.c)
+int recorder_open(struct recorder*, const char* path, const struct game*,
+                  const char* maze_path);
+void recorder_key(struct recorder*, int32_t key);
+int recorder_close(struct recorder*);
+
+// Load the recording at (path)
+int recording_load(struct recording*, const char* path);
+void recording_free(struct recording*);
+
 // Return the status of the game, i.e. WIN, LOSE, NONE
 // This is written to (struct game)->state
+// The player is caught by a troll on its cell, or by one it swapped cells
+// with during the tick: they cannot pass through each other.
 void game_get_status(struct game*);
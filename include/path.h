@@ -6,3 +6,9 @@
 // (t). The length of the array is returned in the passes size_t pointer (l).
 struct path* path_find(const struct maze* m, struct location s,
                        struct location t);
+
+// Allocate a path of (num_steps) steps, from the start
+struct path* path_new(size_t num_steps);
+
+// Free a path and its steps
+void path_delete(struct path*);
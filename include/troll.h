@@ -1,8 +1,47 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-struct entity;
-struct maze;
+#include "game.h"
 
-void trolls_update(const struct maze*, struct entity*);
+// Returned by trolls_index() for handles that do not refer to a troll
+#define TROLL_NONE UINT32_MAX
+
+// Set up an empty set of trolls roaming (maze)
+void trolls_init(struct trolls*, const struct maze* maze);
+
+// Free the trolls and their paths
+void trolls_destroy(struct trolls*);
+
+// Add a troll at (loc), returns its handle
+uint32_t trolls_add(struct trolls*, struct location loc);
+
+// Remove the troll (handle), returns false if there is no such troll
+// The last troll moves into its place, the handles of the others stay valid.
+bool trolls_remove(struct trolls*, uint32_t handle);
+
+// Remove every troll, keeping the memory for the next ones
+// Handles are given out from 0 again, as for a new set of trolls.
+void trolls_clear(struct trolls*);
+
+// Returns the current index of the troll (handle) in the arrays of (trolls),
+// or TROLL_NONE if there is no such troll
+uint32_t trolls_index(const struct trolls*, uint32_t handle);
+
+// Move the troll at index (i) one step
+// New paths go to targets drawn from (rng)
+void trolls_update(const struct maze*, struct trolls*, struct rng*,
+                   uint32_t i);
+
+// Move every troll one step, with the path finding done on (jobs) and spread
+// over ticks by (schedule), NULL for no limit
+// The trolls end up in the same place however many threads (jobs) has.
+// Without a limit, that is exactly where calling trolls_update() on each of
+// them in order would have put them.
+// Far trolls sleep in (trolls)->wheel between their moves, so a tick only
+// goes through the trolls that have something to do.
+void trolls_update_all(const struct maze*, struct trolls*, struct rng*,
+                       struct job_pool*,
+                       const struct trolls_schedule* schedule);
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+#include "path.h"
+#include "troll.h"
+
+/* Checkpoints keep a copy of everything a game changes as it runs: the tick,
+ * the state, the player and the trolls with their paths. The maze, and what
+ * is derived from it, is shared with the game and stays where it is.
+ *
+ * Random numbers are seeded from the tick (see game_begin_tick()), so a game
+ * restored to a checkpoint plays on exactly as it did when the checkpoint was
+ * taken.
+ */
+
+static struct path*
+checkpoint_copy_path(const struct path* path)
+{
+  if (!path)
+    return NULL;
+
+  struct path* copy = path_new(path->num_steps);
+  copy->next = path->next;
+  if (path->num_steps)
+    memcpy(copy->steps, path->steps, path->num_steps * sizeof(*copy->steps));
+
+  return copy;
+}
+
+static void*
+checkpoint_copy(const void* data, size_t size)
+{
+  void* copy = malloc(size ? size : 1);
+  if (!copy)
+    exit(1);
+
+  memcpy(copy, data, size);
+  return copy;
+}
+
+// Copy the trolls of (src) into (dst), leaving the occupancy of (dst) alone
+static void
+checkpoint_copy_trolls(struct trolls* dst, const struct trolls* src)
+{
+  const uint32_t count = src->count;
+  const uint32_t capacity = src->num_handles;
+
+  dst->count = count;
+  dst->capacity = capacity;
+  dst->num_handles = src->num_handles;
+
+  dst->loc = checkpoint_copy(src->loc, capacity * sizeof(*src->loc));
+  dst->face = checkpoint_copy(src->face, capacity * sizeof(*src->face));
+  dst->handle = checkpoint_copy(src->handle, capacity * sizeof(*src->handle));
+  dst->index = checkpoint_copy(src->index, capacity * sizeof(*src->index));
+
+  dst->path = malloc((capacity ? capacity : 1) * sizeof(*dst->path));
+  if (!dst->path)
+    exit(1);
+
+  for (uint32_t i = 0; i < count; i++)
+    dst->path[i] = checkpoint_copy_path(src->path[i]);
+}
+
+void
+game_checkpoint_save(const struct game* game, struct game_checkpoint* cp)
+{
+  *cp = (struct game_checkpoint){
+    .tick = game->tick,
+    .state = game->state,
+    .player_loc = game->player->loc,
+    .player_face = game->player->face,
+  };
+
+  checkpoint_copy_trolls(&cp->trolls, &game->trolls);
+}
+
+void
+game_checkpoint_restore(struct game* game, const struct game_checkpoint* cp)
+{
+  game->tick = cp->tick;
+  game->state = cp->state;
+  game->player->loc = cp->player_loc;
+  game->player->face = cp->player_face;
+
+  // Start the trolls over, with their occupancy counted from scratch
+  trolls_destroy(&game->trolls);
+  trolls_init(&game->trolls, &game->maze);
+  checkpoint_copy_trolls(&game->trolls, &cp->trolls);
+
+  for (uint32_t i = 0; i < game->trolls.count; i++)
+    occupancy_add(&game->trolls.occupancy, game->trolls.loc[i]);
+
+  // The player may have moved, and the field of view with it
+  game->vision.valid = false;
+}
+
+void
+game_checkpoint_free(struct game_checkpoint* cp)
+{
+  // The checkpoint never sets up occupancy counts, there is nothing to free
+  for (uint32_t i = 0; i < cp->trolls.count; i++)
+    path_delete(cp->trolls.path[i]);
+
+  free(cp->trolls.loc);
+  free(cp->trolls.face);
+  free(cp->trolls.path);
+  free(cp->trolls.handle);
+  free(cp->trolls.index);
+
+  *cp = (struct game_checkpoint){ 0 };
+}
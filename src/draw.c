@@ -1,101 +1,388 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "draw.h"
-#include "game.h"    // for entity, location, maze
-#include <curses.h>  // for mvprintw, chtype, nodelay, stdscr, attrset, A_BOLD
-#include <locale.h>  // for setlocale, LC_ALL, NULL
-#include <stdbool.h> // for false, true
-#include <stdint.h>  // for uint8_t, uint16_t
-#include <stdlib.h>  // for srand, size_t
-#include <time.h>    // for time
-
-static const uint8_t X_OFF = 5;
-static const uint8_t Y_OFF = 5;
-
-static const enum draw_colors {
-  DRAW_WHITE = 0,
-  DRAW_RED,
-  DRAW_GREEN,
-  DRAW_YELLOW,
-  DRAW_BLUE,
-  DRAW_MAGENTA,
-  DRAW_CYAN,
-} colors[] = {
-    [DRAW_WHITE] = COLOR_WHITE, [DRAW_RED] = COLOR_RED,
-    [DRAW_GREEN] = COLOR_GREEN, [DRAW_YELLOW] = COLOR_YELLOW,
-    [DRAW_BLUE] = COLOR_BLUE,   [DRAW_MAGENTA] = COLOR_MAGENTA,
-    [DRAW_CYAN] = COLOR_CYAN,
+#include "game.h"      // for game, location, maze, trolls, fov_visible
+#include <errno.h>     // for errno, EINTR
+#include <pthread.h>   // for pthread_create, pthread_join
+#include <semaphore.h> // for sem_init, sem_post, sem_wait, sem_destroy
+#include <stdatomic.h> // for atomic_uint, atomic_exchange, atomic_load
+#include <stdbool.h>   // for bool, false, true
+#include <stdint.h>    // for uint16_t, uint32_t, uint64_t
+#include <stdio.h>     // for snprintf, fprintf
+#include <stdlib.h>    // for size_t, realloc, free
+#include <string.h>    // for strcmp, memcpy
+#include <time.h>      // for clock_gettime
+#include <unistd.h>    // for read
+
+static const struct renderer* const renderers[] = {
+  &draw_ncurses,
+  &draw_ansi,
+  &draw_null,
 };
 
+static const struct renderer* active;
+
+// Set in (middle) while it holds a scene not yet drawn
+#define DRAW_FRESH 4u
+
+// The scenes between the game and the render thread
+static struct
+{
+  struct draw_scene scenes[3];
+  uint32_t back;       // the scene the game fills, its own
+  uint32_t front;      // the scene being drawn, the render thread's own
+  atomic_uint middle;  // the latest scene handed over
+  atomic_bool running; // false once the render thread is to stop
+  sem_t ready;         // posted after handing a scene over
+  pthread_t thread;
+  bool started;
+  uint64_t dropped;
+} handoff;
+
+// The next frame, and the one the terminal has on it
+// Only the render thread gets to them while it runs.
+static struct
+{
+  struct location origin; // the cell of the maze at the top left
+  uint32_t width;
+  uint32_t height;
+  uint16_t* next;
+  uint16_t* shown;
+  char status[64];
+  char shown_status[64];
+
+  struct draw_stats stats;
+} frame;
+
+static uint64_t
+draw_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+const struct renderer*
+draw_renderer(const char* name)
+{
+  for (size_t i = 0; i < LEN(renderers); i++)
+    if (strcmp(renderers[i]->name, name) == 0)
+      return renderers[i];
+
+  return NULL;
+}
+
+// Put (scene) on the screen
+static void
+draw_render(const struct draw_scene* scene)
+{
+  const uint64_t start = draw_now();
+
+  active->begin_frame(scene);
+  active->maze(scene);
+  active->entities(scene);
+  active->end_frame();
+
+  const uint64_t end = draw_now();
+  const uint64_t latency = end - scene->taken;
+
+  frame.stats.frames++;
+  frame.stats.ns += end - start;
+  frame.stats.latency_ns += latency;
+  if (latency > frame.stats.latency_max)
+    frame.stats.latency_max = latency;
+}
+
+// The render thread: draws the latest scene every time one is handed over
+static void*
+draw_thread(void* arg)
+{
+  (void)arg;
+
+  for (;;) {
+    while (sem_wait(&handoff.ready) != 0 && errno == EINTR)
+      ;
+
+    // Whatever was handed over before stopping is still drawn
+    const bool running = atomic_load(&handoff.running);
+    if (atomic_load(&handoff.middle) & DRAW_FRESH) {
+      handoff.front = atomic_exchange(&handoff.middle, handoff.front);
+      handoff.front &= ~DRAW_FRESH;
+      draw_render(&handoff.scenes[handoff.front]);
+    }
+
+    if (!running)
+      return NULL;
+  }
+}
+
 void
-draw_init()
+draw_init(const struct renderer* renderer)
 {
-  srand((unsigned int)time(NULL));
-  setlocale(LC_ALL, "");
+  active = renderer;
+  active->init();
 
-  initscr();
-  cbreak();
-  noecho();
-  nonl();
-  intrflush(stdscr, FALSE);
-  keypad(stdscr, TRUE);
-  curs_set(0);
+  handoff.back = 0;
+  handoff.front = 1;
+  atomic_init(&handoff.middle, 2);
+  atomic_init(&handoff.running, true);
+  if (sem_init(&handoff.ready, 0, 0) != 0 ||
+      pthread_create(&handoff.thread, NULL, draw_thread, NULL) != 0)
+    exit(1);
+  handoff.started = true;
+}
+
+// Copy what the player of (game) sees into (scene)
+static void
+draw_scene_take(struct draw_scene* scene, const struct game* game)
+{
+  const struct maze* maze = &game->maze;
+  const struct fov* fov = &game->vision;
 
-  start_color();
-  for (uint8_t i = 0; i < LEN(colors); i++)
-    init_pair(i + 1, colors[i], COLOR_BLACK);
+  scene->maze_width = maze->maze_width;
+  scene->maze_height = maze->maze_height;
+  scene->player = game->player->loc;
+  scene->face = game->player->face;
+  scene->width = scene->height = 0;
+  scene->num_trolls = 0;
 
-  refresh();
+  if (fov->valid && maze->maze_width && maze->maze_height) {
+    // The square of the field of view, within the maze
+    const struct location o = fov->origin;
+    const uint32_t r = fov->radius;
+    scene->origin.x = o.x > r ? o.x - r : 0;
+    scene->origin.y = o.y > r ? o.y - r : 0;
+    const uint32_t right =
+      o.x + r < maze->maze_width - 1 ? o.x + r : maze->maze_width - 1;
+    const uint32_t bottom =
+      o.y + r < maze->maze_height - 1 ? o.y + r : maze->maze_height - 1;
+    scene->width = right + 1 - scene->origin.x;
+    scene->height = bottom + 1 - scene->origin.y;
+  }
+
+  const size_t size = (size_t)scene->width * scene->height;
+  if (size > scene->cell_capacity) {
+    scene->cell_capacity = size;
+    scene->cells = realloc(scene->cells, size);
+    if (!scene->cells)
+      exit(1);
+  }
+
+  char* cell = scene->cells;
+  for (uint32_t y = 0; y < scene->height; y++) {
+    for (uint32_t x = 0; x < scene->width; x++) {
+      const struct location loc = {.x = scene->origin.x + x,
+                                   .y = scene->origin.y + y };
+      if (!fov_visible(fov, loc)) {
+        *cell++ = ' ';
+        continue;
+      }
+      *cell++ = maze_cell(maze, loc.x, loc.y);
+
+      // Trolls are looked up in the occupancy counts of the cells in view
+      // rather than going through all of them
+      if (!occupancy_count(&game->trolls.occupancy, loc))
+        continue;
+      if (scene->num_trolls == scene->troll_capacity) {
+        scene->troll_capacity =
+          scene->troll_capacity ? scene->troll_capacity * 2 : 16;
+        scene->trolls = realloc(
+          scene->trolls, scene->troll_capacity * sizeof(*scene->trolls));
+        if (!scene->trolls)
+          exit(1);
+      }
+      scene->trolls[scene->num_trolls++] = loc;
+    }
+  }
+
+  scene->taken = draw_now();
 }
 
 void
-draw_cleanup()
+draw_show(const struct game* game)
 {
-  nodelay(stdscr, true); // make getch() non-blocking
-  while (getch() != ERR)
-    ; // drop all user input
-  nodelay(stdscr, false);
+  draw_scene_take(&handoff.scenes[handoff.back], game);
+
+  const uint32_t old =
+    atomic_exchange(&handoff.middle, handoff.back | DRAW_FRESH);
+  handoff.dropped += (old & DRAW_FRESH) != 0;
+  handoff.back = old & ~DRAW_FRESH;
 
-  refresh();
-  endwin();
+  sem_post(&handoff.ready);
 }
 
-int
-draw_getch(void)
+void
+draw_stop(void)
 {
-  return getch();
+  if (!handoff.started)
+    return;
+
+  atomic_store(&handoff.running, false);
+  sem_post(&handoff.ready);
+  pthread_join(handoff.thread, NULL);
+  sem_destroy(&handoff.ready);
+  handoff.started = false;
 }
 
 void
-draw_game_over(void)
+draw_cleanup(void)
 {
-  attrset(COLOR_PAIR(colors[DRAW_RED]) | A_BOLD);
-  mvprintw(1, 0, "GAME OVER");
+  if (!active)
+    return;
+
+  draw_stop();
+  active->cleanup();
+
+#ifdef DEBUG
+  const struct draw_stats stats = draw_stats();
+  if (stats.frames) {
+    fprintf(stderr,
+            "%s: %llu frames, %.1f us, %.1f cells and %.1f bytes per frame, "
+            "%llu camera moves\n",
+            active->name, (unsigned long long)stats.frames,
+            (double)stats.ns / 1e3 / (double)stats.frames,
+            (double)stats.cells / (double)stats.frames,
+            (double)stats.bytes / (double)stats.frames,
+            (unsigned long long)stats.moves);
+    fprintf(stderr,
+            "%llu scenes dropped, %.1f us latency on average, %.1f us at "
+            "most\n",
+            (unsigned long long)stats.dropped,
+            (double)stats.latency_ns / 1e3 / (double)stats.frames,
+            (double)stats.latency_max / 1e3);
+  }
+#endif
+
+  active = NULL;
+
+  for (size_t i = 0; i < LEN(handoff.scenes); i++) {
+    free(handoff.scenes[i].cells);
+    free(handoff.scenes[i].trolls);
+    handoff.scenes[i] = (struct draw_scene){ 0 };
+  }
+
+  free(frame.next);
+  free(frame.shown);
+  frame.next = frame.shown = NULL;
+  frame.width = frame.height = 0;
+}
+
+struct draw_stats
+draw_stats(void)
+{
+  struct draw_stats stats = frame.stats;
+  stats.dropped = handoff.dropped;
+  return stats;
+}
+
+int
+draw_read_key(void)
+{
+  unsigned char key;
+  ssize_t n;
+  do
+    n = read(STDIN_FILENO, &key, 1);
+  while (n < 0 && errno == EINTR);
+
+  return n == 1 ? key : DRAW_EOF;
+}
+
+// Returns where a window of (size) cells starts on an axis of (extent) cells
+// for (focus) to be in it, which is (origin) unless (focus) is within a
+// quarter of the window of one of its edges
+static uint32_t
+draw_camera(uint32_t origin, uint32_t focus, uint32_t size, uint32_t extent)
+{
+  const uint32_t margin = size / 4;
+  if (focus < origin + margin || focus + margin >= origin + size)
+    origin = focus > size / 2 ? focus - size / 2 : 0;
+
+  return origin + size > extent ? extent - size : origin;
+}
+
+// A frame of a new size starts from a blank screen
+bool
+draw_frame_begin(const struct draw_scene* scene, uint32_t columns,
+                 uint32_t lines)
+{
+  // The window is as large as the screen below and right of the status
+  // line, or the maze if that is smaller
+  columns = columns > DRAW_X_OFF ? columns - DRAW_X_OFF : 0;
+  lines = lines > DRAW_Y_OFF ? lines - DRAW_Y_OFF : 0;
+  const uint32_t width =
+    columns < scene->maze_width ? columns : scene->maze_width;
+  const uint32_t height =
+    lines < scene->maze_height ? lines : scene->maze_height;
+
+  const struct location origin = {
+    .x = draw_camera(frame.origin.x, scene->player.x, width, scene->maze_width),
+    .y =
+      draw_camera(frame.origin.y, scene->player.y, height, scene->maze_height),
+  };
+  frame.stats.moves +=
+    origin.x != frame.origin.x || origin.y != frame.origin.y;
+  frame.origin = origin;
+
+  if (frame.width == width && frame.height == height)
+    return false;
+
+  const size_t size = (size_t)width * height;
+  frame.next = realloc(frame.next, size * sizeof(*frame.next));
+  frame.shown = realloc(frame.shown, size * sizeof(*frame.shown));
+  if (size && (!frame.next || !frame.shown))
+    exit(1);
+
+  for (size_t i = 0; i < size; i++)
+    frame.shown[i] = DRAW_CELL(' ', DRAW_PLAIN);
+
+  frame.width = width;
+  frame.height = height;
+  frame.shown_status[0] = '\0';
+
+  return true;
+}
+
+// Put (cell) at (loc) of the maze on the next frame, if it is in the window
+static void
+draw_cell(struct location loc, uint16_t cell)
+{
+  // Wrapped unsigned differences put cells left of or above the window out
+  const uint32_t x = loc.x - frame.origin.x;
+  const uint32_t y = loc.y - frame.origin.y;
+  if (x < frame.width && y < frame.height)
+    frame.next[(size_t)y * frame.width + x] = cell;
 }
 
+// Only the cells of the scene are looked up, the rest of the window is blank
 void
-draw_maze(const struct maze* maze)
-{
-  clear();
-  attrset(A_NORMAL);
-
-  for (uint8_t y = 0; y < maze->maze_height; y++) {
-    for (uint8_t x = 0; x < maze->maze_width; x++) {
-      // FIXME
-      // Needs player
-      // struct location new_xy = { .x = x, .y = y };
-      // if (location_distance(player.loc, new_xy) < game->player_vision)
-      mvprintw(Y_OFF + y, X_OFF + x, "%c", MAZE_XY(maze, x, y));
+draw_frame_maze(const struct draw_scene* scene)
+{
+  const size_t size = (size_t)frame.width * frame.height;
+  for (size_t i = 0; i < size; i++)
+    frame.next[i] = DRAW_CELL(' ', DRAW_PLAIN);
+
+  const char* cell = scene->cells;
+  for (uint32_t y = 0; y < scene->height; y++) {
+    for (uint32_t x = 0; x < scene->width; x++, cell++) {
+      const struct location loc = {.x = scene->origin.x + x,
+                                   .y = scene->origin.y + y };
+      if (*cell != ' ')
+        draw_cell(loc, DRAW_CELL(*cell, DRAW_PLAIN));
     }
   }
 }
 
 void
-draw_player(const struct entity* player)
+draw_frame_entities(const struct draw_scene* scene)
 {
-  attrset(COLOR_PAIR(colors[DRAW_MAGENTA]) | A_BOLD);
-  mvprintw(0, 0, "Player: (%.2d, %.2d)", player->loc.x, player->loc.y);
+  for (uint32_t i = 0; i < scene->num_trolls; i++)
+    draw_cell(scene->trolls[i], DRAW_CELL('T', DRAW_TROLL));
+
+  snprintf(frame.status, sizeof(frame.status), "Player: (%.2d, %.2d)",
+           scene->player.x, scene->player.y);
 
   char pchar;
-  switch (player->face) {
+  switch (scene->face) {
     case NORTH:
       pchar = '^';
       break;
@@ -112,17 +399,53 @@ draw_player(const struct entity* player)
       pchar = 'x';
       break;
   }
-  mvprintw(Y_OFF + player->loc.y, X_OFF + player->loc.x, "%c", pchar);
+  draw_cell(scene->player, DRAW_CELL(pchar, DRAW_PLAYER));
 }
 
 void
-draw_trolls(const struct entity* troll)
+draw_frame_runs(void (*emit)(void* ctx, uint32_t x, uint32_t y,
+                             const uint16_t* cells, uint32_t count),
+                void* ctx)
 {
-  attrset(COLOR_PAIR(colors[DRAW_BLUE]) | A_BOLD);
+  const uint32_t width = frame.width;
+
+  for (uint32_t y = 0; y < frame.height; y++) {
+    uint16_t* next = &frame.next[(size_t)y * width];
+    uint16_t* shown = &frame.shown[(size_t)y * width];
+
+    for (uint32_t x = 0; x < width;) {
+      if (next[x] == shown[x]) {
+        x++;
+        continue;
+      }
+
+      // The run of changed cells from x on
+      uint32_t end = x + 1;
+      while (end < width && next[end] != shown[end])
+        end++;
 
-  // FIXME
-  // Needs player
-  // int32_t dist = location_distance(game->player.loc, game->trolls[i].loc);
-  // if (dist < game->player_vision)
-  mvprintw(Y_OFF + troll->loc.y, X_OFF + troll->loc.x, "%c", 'T');
+      emit(ctx, x, y, &next[x], end - x);
+      memcpy(&shown[x], &next[x], (end - x) * sizeof(*next));
+
+      frame.stats.cells += end - x;
+      frame.stats.runs++;
+      x = end;
+    }
+  }
+}
+
+const char*
+draw_frame_status(void)
+{
+  if (strcmp(frame.status, frame.shown_status) == 0)
+    return NULL;
+
+  memcpy(frame.shown_status, frame.status, sizeof(frame.status));
+  return frame.status;
+}
+
+void
+draw_frame_sent(uint64_t bytes)
+{
+  frame.stats.bytes += bytes;
 }
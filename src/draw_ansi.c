@@ -0,0 +1,193 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "draw.h"
+#include <errno.h>     // for errno, EINTR
+#include <stdbool.h>   // for bool, false, true
+#include <stdint.h>    // for uint16_t, uint32_t
+#include <stdio.h>     // for snprintf
+#include <stdlib.h>    // for size_t, realloc, free
+#include <string.h>    // for strlen, memcpy
+#include <sys/ioctl.h> // for ioctl, winsize, TIOCGWINSZ
+#include <termios.h>   // for tcgetattr, tcsetattr, tcflush, termios
+#include <unistd.h>    // for write, isatty
+
+/* Draws with ANSI escape sequences, without curses
+ *
+ * A frame is built in one buffer, the cursor moves, colors and cells of it,
+ * and goes to the terminal in a single write(2). The terminal is put in
+ * non-canonical mode without echo for the keys to come one at a time.
+ */
+
+static const char* const sgr[] = {
+  [DRAW_PLAIN] = "\x1b[0m",
+  [DRAW_PLAYER] = "\x1b[0;1;34m",
+  [DRAW_TROLL] = "\x1b[0;1;33m",
+};
+
+static struct
+{
+  char* buf;
+  size_t len;
+  size_t capacity;
+
+  enum draw_color color; // what the terminal draws in now
+  struct termios saved;  // the terminal settings to go back to
+  bool raw;
+} ansi;
+
+static void
+ansi_put(const char* str, size_t len)
+{
+  if (ansi.len + len > ansi.capacity) {
+    while (ansi.len + len > ansi.capacity)
+      ansi.capacity = ansi.capacity ? ansi.capacity * 2 : 4096;
+    ansi.buf = realloc(ansi.buf, ansi.capacity);
+    if (!ansi.buf)
+      exit(1);
+  }
+
+  memcpy(&ansi.buf[ansi.len], str, len);
+  ansi.len += len;
+}
+
+static void
+ansi_puts(const char* str)
+{
+  ansi_put(str, strlen(str));
+}
+
+// Move the cursor to (x, y), counted from 0
+static void
+ansi_move(uint32_t x, uint32_t y)
+{
+  char move[32];
+  const int len = snprintf(move, sizeof(move), "\x1b[%u;%uH", y + 1, x + 1);
+  ansi_put(move, (size_t)len);
+}
+
+static void
+ansi_color(enum draw_color color)
+{
+  if (color != ansi.color) {
+    ansi_puts(sgr[color]);
+    ansi.color = color;
+  }
+}
+
+// Send the buffer to the terminal and empty it
+// Returns the number of bytes written
+static size_t
+ansi_flush(void)
+{
+  size_t done = 0;
+  while (done < ansi.len) {
+    const ssize_t n = write(STDOUT_FILENO, &ansi.buf[done], ansi.len - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t)n;
+  }
+
+  ansi.len = 0;
+  return done;
+}
+
+static void
+ansi_init(void)
+{
+  ansi.raw = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &ansi.saved) == 0;
+  if (ansi.raw) {
+    struct termios raw = ansi.saved;
+    raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+  }
+
+  // The alternate screen, without a cursor
+  ansi_puts("\x1b[?1049h\x1b[?25l\x1b[0m\x1b[2J");
+  ansi.color = DRAW_PLAIN;
+  ansi_flush();
+}
+
+static void
+ansi_cleanup(void)
+{
+  ansi_puts("\x1b[0m\x1b[?25h\x1b[?1049l");
+  ansi_flush();
+
+  if (ansi.raw) {
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &ansi.saved); // drops all user input
+    ansi.raw = false;
+  }
+
+  free(ansi.buf);
+  ansi.buf = NULL;
+  ansi.len = ansi.capacity = 0;
+}
+
+// Without a terminal to ask, the screen is taken to be 80 x 24
+static void
+ansi_begin_frame(const struct draw_scene* scene)
+{
+  struct winsize size;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || !size.ws_col)
+    size = (struct winsize){.ws_col = 80, .ws_row = 24 };
+
+  if (draw_frame_begin(scene, size.ws_col, size.ws_row)) {
+    ansi_color(DRAW_PLAIN);
+    ansi_puts("\x1b[2J");
+  }
+}
+
+static void
+ansi_run(void* ctx, uint32_t x, uint32_t y, const uint16_t* cells,
+         uint32_t count)
+{
+  (void)ctx;
+
+  ansi_move(DRAW_X_OFF + x, DRAW_Y_OFF + y);
+  for (uint32_t i = 0; i < count; i++) {
+    const char ch = DRAW_CELL_CHAR(cells[i]);
+    ansi_color(DRAW_CELL_COLOR(cells[i]));
+    ansi_put(&ch, 1);
+  }
+}
+
+static void
+ansi_end_frame(void)
+{
+  draw_frame_runs(ansi_run, NULL);
+
+  const char* status = draw_frame_status();
+  if (status) {
+    ansi_move(0, 0);
+    ansi_color(DRAW_PLAYER);
+    ansi_puts(status);
+    ansi_puts("\x1b[K");
+  }
+
+  draw_frame_sent(ansi_flush());
+}
+
+static void
+ansi_game_over(void)
+{
+  ansi_move(0, 1);
+  ansi_puts("\x1b[0;1;31mGAME OVER");
+  ansi.color = DRAW_PLAYER; // anything but plain, for the next color to go
+  ansi_flush();
+}
+
+const struct renderer draw_ansi = {
+  .name = "ansi",
+  .init = ansi_init,
+  .cleanup = ansi_cleanup,
+  .begin_frame = ansi_begin_frame,
+  .maze = draw_frame_maze,
+  .entities = draw_frame_entities,
+  .end_frame = ansi_end_frame,
+  .input = draw_read_key,
+  .game_over = ansi_game_over,
+};
@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "draw.h"
+#include "game.h"      // for LEN
+#include <curses.h>    // for mvaddchnstr, chtype, resizeterm, A_BOLD
+#include <locale.h>    // for setlocale, LC_ALL
+#include <stdbool.h>   // for false, true
+#include <stdint.h>    // for uint8_t, uint16_t, uint32_t
+#include <sys/ioctl.h> // for ioctl, winsize, TIOCGWINSZ
+#include <unistd.h>    // for STDOUT_FILENO
+
+static const enum draw_colors {
+  DRAW_WHITE = 0,
+  DRAW_RED,
+  DRAW_GREEN,
+  DRAW_YELLOW,
+  DRAW_BLUE,
+  DRAW_MAGENTA,
+  DRAW_CYAN,
+} colors[] = {
+    [DRAW_WHITE] = COLOR_WHITE, [DRAW_RED] = COLOR_RED,
+    [DRAW_GREEN] = COLOR_GREEN, [DRAW_YELLOW] = COLOR_YELLOW,
+    [DRAW_BLUE] = COLOR_BLUE,   [DRAW_MAGENTA] = COLOR_MAGENTA,
+    [DRAW_CYAN] = COLOR_CYAN,
+};
+
+static chtype
+ncurses_attr(enum draw_color color)
+{
+  switch (color) {
+    case DRAW_PLAYER:
+      return COLOR_PAIR(colors[DRAW_MAGENTA]) | A_BOLD;
+    case DRAW_TROLL:
+      return COLOR_PAIR(colors[DRAW_BLUE]) | A_BOLD;
+    default:
+      return A_NORMAL;
+  }
+}
+
+static void
+ncurses_init(void)
+{
+  setlocale(LC_ALL, "");
+
+  initscr();
+  cbreak();
+  noecho();
+  nonl();
+  intrflush(stdscr, FALSE);
+  keypad(stdscr, TRUE);
+  curs_set(0);
+
+  start_color();
+  for (uint8_t i = 0; i < LEN(colors); i++)
+    init_pair(i + 1, colors[i], COLOR_BLACK);
+
+  refresh();
+}
+
+static void
+ncurses_cleanup(void)
+{
+  nodelay(stdscr, true); // make getch() non-blocking
+  while (getch() != ERR)
+    ; // drop all user input
+  nodelay(stdscr, false);
+
+  refresh();
+  endwin();
+}
+
+// Keys are read on the thread of the game rather than with getch(), which
+// would pick up changes of the size of the terminal: that is done here
+static void
+ncurses_begin_frame(const struct draw_scene* scene)
+{
+  struct winsize size;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 &&
+      is_term_resized(size.ws_row, size.ws_col))
+    resizeterm(size.ws_row, size.ws_col);
+
+  int lines, columns;
+  getmaxyx(stdscr, lines, columns);
+
+  if (draw_frame_begin(scene, (uint32_t)columns, (uint32_t)lines))
+    clear();
+}
+
+// Put a run of cells on the curses screen
+static void
+ncurses_run(void* ctx, uint32_t x, uint32_t y, const uint16_t* cells,
+            uint32_t count)
+{
+  (void)ctx;
+
+  chtype run[256];
+  while (count) {
+    const uint32_t n = count < LEN(run) ? count : (uint32_t)LEN(run);
+    for (uint32_t i = 0; i < n; i++)
+      run[i] = (chtype)(unsigned char)DRAW_CELL_CHAR(cells[i]) |
+               ncurses_attr(DRAW_CELL_COLOR(cells[i]));
+
+    mvaddchnstr(DRAW_Y_OFF + (int)y, DRAW_X_OFF + (int)x, run, (int)n);
+    x += n;
+    cells += n;
+    count -= n;
+  }
+}
+
+// curses does not say what it wrote, so no bytes are counted
+static void
+ncurses_end_frame(void)
+{
+  draw_frame_runs(ncurses_run, NULL);
+
+  const char* status = draw_frame_status();
+  if (status) {
+    attrset(ncurses_attr(DRAW_PLAYER));
+    mvaddstr(0, 0, status);
+    clrtoeol();
+    attrset(A_NORMAL);
+  }
+
+  refresh();
+}
+
+static void
+ncurses_game_over(void)
+{
+  attrset(COLOR_PAIR(colors[DRAW_RED]) | A_BOLD);
+  mvaddstr(1, 0, "GAME OVER");
+}
+
+const struct renderer draw_ncurses = {
+  .name = "ncurses",
+  .init = ncurses_init,
+  .cleanup = ncurses_cleanup,
+  .begin_frame = ncurses_begin_frame,
+  .maze = draw_frame_maze,
+  .entities = draw_frame_entities,
+  .end_frame = ncurses_end_frame,
+  .input = draw_read_key,
+  .game_over = ncurses_game_over,
+};
@@ -0,0 +1,30 @@
+#include "draw.h"
+
+/* Draws nothing, for timing the game without a terminal in the way
+ *
+ * Keys are read from standard input as they come, so a game can be played
+ * from a file or a pipe: `yes d | ./trolls -d null`.
+ */
+
+static void
+null_none(void)
+{
+}
+
+static void
+null_scene(const struct draw_scene* scene)
+{
+  (void)scene;
+}
+
+const struct renderer draw_null = {
+  .name = "null",
+  .init = null_none,
+  .cleanup = null_none,
+  .begin_frame = null_scene,
+  .maze = null_scene,
+  .entities = null_scene,
+  .end_frame = null_none,
+  .input = draw_read_key,
+  .game_over = null_none,
+};
@@ -6,11 +6,7 @@
 struct entity*
 entity_new(void)
 {
-  struct entity* ret = calloc(1, sizeof(*ret));
-  if (!ret)
-    exit(1);
-
-  return ret;
+  return pool_get(POOL_ENTITY);
 }
 
 void
@@ -22,13 +18,10 @@ entity_delete(struct entity** entity)
 
   e = *entity;
 
-  if (e->path) {
-    free(e->path->steps);
-    free(e->path);
-    e->path = NULL;
-  }
+  path_delete(e->path);
+  e->path = NULL;
 
-  free(e);
+  pool_put(POOL_ENTITY, e);
   *entity = NULL;
 }
 
@@ -36,11 +29,14 @@ entity_delete(struct entity** entity)
 // We make sure the space is empty, and return 1 if we've moved
 // Return 2 if we haven't moved but did change our direction
 // Return 0 if we couldn't move, but we are facing the correct direction
+//
+// The occupancy counts of the entity, if any, follow it.
 int
 entity_move(const struct maze* maze, struct entity* entity, enum direction dir)
 {
-  const uint16_t x = entity->loc.x;
-  const uint16_t y = entity->loc.y;
+  const struct location from = entity->loc;
+  const uint32_t x = entity->loc.x;
+  const uint32_t y = entity->loc.y;
 
   if (entity->face != dir) {
     entity->face = dir;
@@ -81,6 +77,9 @@ entity_move(const struct maze* maze, struct entity* entity, enum direction dir)
       break;
   }
 
+  if (entity->occupancy)
+    occupancy_move(entity->occupancy, from, entity->loc);
+
   return 1;
 }
 
@@ -108,8 +107,7 @@ entity_follow_path(const struct maze* maze, struct entity* entity)
 
   // We've already stepped through the path
   if (path->next >= path->num_steps) {
-    free(path->steps);
-    free(path);
+    path_delete(path);
     entity->path = NULL;
     return 0;
   }
@@ -118,8 +116,7 @@ entity_follow_path(const struct maze* maze, struct entity* entity)
 
   if (try_move == 0) {
     // Cannot follow path or it doesn't exist
-    free(path->steps);
-    free(path);
+    path_delete(path);
     entity->path = NULL;
 
   } else if (try_move == 1) {
@@ -141,11 +138,8 @@ int
 entity_new_path(const struct maze* maze, struct entity* entity,
                 struct location target)
 {
-  if (entity->path) {
-    free(entity->path->steps);
-    free(entity->path);
-    entity->path = NULL;
-  }
+  path_delete(entity->path);
+  entity->path = NULL;
 
   struct path* new_path = path_find(maze, entity->loc, target);
 
@@ -160,31 +154,37 @@ entity_new_path(const struct maze* maze, struct entity* entity,
 // Looks in direction (dir) from the position of the entity (entity) until a
 // wall is hit.
 // If the entity is standing next to a wall in direction (dir): return 0
+//
+// With the wall distance tables (see maze_build_rays()) this is one lookup,
+// otherwise we walk the maze.
 int
 entity_look(const struct maze* maze, const struct entity* entity,
             enum direction dir)
 {
-  uint16_t x = entity->loc.x;
-  uint16_t y = entity->loc.y;
+  uint32_t x = entity->loc.x;
+  uint32_t y = entity->loc.y;
+
+  if (maze->rays && maze_check_bound_loc(maze, entity->loc))
+    return maze->rays[4 * maze_index(maze, x, y) + dir];
 
   switch (dir) {
     case NORTH:
-      while (maze_check_bound(maze, --y, NORTH) && MAZE_XY(maze, x, y) != '#')
+      while (maze_check_bound(maze, --y, NORTH) && maze_cell(maze, x, y) != '#')
         ;
       return entity->loc.y - y - 1;
 
     case SOUTH:
-      while (maze_check_bound(maze, ++y, SOUTH) && MAZE_XY(maze, x, y) != '#')
+      while (maze_check_bound(maze, ++y, SOUTH) && maze_cell(maze, x, y) != '#')
         ;
       return y - entity->loc.y - 1;
 
     case EAST:
-      while (maze_check_bound(maze, ++x, EAST) && MAZE_XY(maze, x, y) != '#')
+      while (maze_check_bound(maze, ++x, EAST) && maze_cell(maze, x, y) != '#')
         ;
       return x - entity->loc.x - 1;
 
     case WEST:
-      while (maze_check_bound(maze, --x, WEST) && MAZE_XY(maze, x, y) != '#')
+      while (maze_check_bound(maze, --x, WEST) && maze_cell(maze, x, y) != '#')
         ;
       return entity->loc.x - x - 1;
   }
@@ -0,0 +1,166 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+/* Field of view by recursive shadowcasting
+ *
+ * The cells around the origin are split into eight octants. Each octant is
+ * scanned row by row moving away from the origin, keeping track of the range
+ * of slopes that is still lit. A wall casts a shadow over the slopes behind
+ * it: when a row goes from open to wall, the lit part of the next rows before
+ * the wall is scanned recursively, and the scan carries on past the wall.
+ *
+ * The visible cells are kept in a bitmap of the (2 * radius + 1) square
+ * centred on the origin, so its size does not depend on the maze. It is only
+ * recomputed when the origin or the maze changes.
+ */
+
+// Maps the (col, row) coordinates of an octant to maze offsets
+static const int32_t fov_octants[8][4] = {
+  { 1, 0, 0, 1 },  { 0, 1, 1, 0 },  { 0, -1, 1, 0 }, { -1, 0, 0, 1 },
+  { -1, 0, 0, -1 }, { 0, -1, -1, 0 }, { 0, 1, -1, 0 }, { 1, 0, 0, -1 },
+};
+
+void
+fov_init(struct fov* fov, uint32_t radius)
+{
+  const size_t side = 2 * (size_t)radius + 1;
+
+  *fov = (struct fov){.radius = radius };
+  fov->visible = calloc((side * side + 7) / 8, sizeof(*fov->visible));
+  if (!fov->visible)
+    exit(1);
+}
+
+void
+fov_destroy(struct fov* fov)
+{
+  free(fov->visible);
+  *fov = (struct fov){ 0 };
+}
+
+// Position of the offset (dx, dy) from the origin in the bitmap
+static size_t
+fov_bit(const struct fov* fov, int32_t dx, int32_t dy)
+{
+  const size_t side = 2 * (size_t)fov->radius + 1;
+  return side * (size_t)(dy + (int32_t)fov->radius) +
+         (size_t)(dx + (int32_t)fov->radius);
+}
+
+static void
+fov_set(struct fov* fov, int32_t dx, int32_t dy)
+{
+  const size_t bit = fov_bit(fov, dx, dy);
+  fov->visible[bit / 8] |= (uint8_t)(1u << (bit % 8));
+}
+
+bool
+fov_visible(const struct fov* fov, struct location loc)
+{
+  if (!fov->valid)
+    return false;
+
+  // Wrapped unsigned differences keep cells left of or above the origin
+  // negative
+  const int32_t dx = (int32_t)(loc.x - fov->origin.x);
+  const int32_t dy = (int32_t)(loc.y - fov->origin.y);
+  const int32_t r = (int32_t)fov->radius;
+
+  if (dx < -r || dx > r || dy < -r || dy > r)
+    return false;
+
+  const size_t bit = fov_bit(fov, dx, dy);
+  return fov->visible[bit / 8] & (1u << (bit % 8));
+}
+
+// Scan the rows (row) and up of octant (oct) between the slopes (start) and
+// (end), start > end
+static void
+fov_cast(struct fov* fov, const struct maze* maze, const int32_t oct[4],
+         int32_t row, double start, double end)
+{
+  const int32_t radius = (int32_t)fov->radius;
+  const int32_t radius2 = radius * radius;
+
+  if (start < end)
+    return;
+
+  for (int32_t j = row; j <= radius; j++) {
+    bool blocked = false;
+    double next_start = start;
+
+    for (int32_t i = -j; i <= 0; i++) {
+      // Slopes of the corners of the cell, as seen from the origin
+      const double left = (i - 0.5) / (-j + 0.5);
+      const double right = (i + 0.5) / (-j - 0.5);
+
+      if (start < right)
+        continue;
+      if (end > left)
+        break;
+
+      const int32_t dx = i * oct[0] - j * oct[1];
+      const int32_t dy = i * oct[2] - j * oct[3];
+      const struct location loc = {.x = fov->origin.x + (uint32_t)dx,
+                                   .y = fov->origin.y + (uint32_t)dy };
+
+      // Everything outside of the maze blocks the view
+      const bool inside = maze_check_bound_loc(maze, loc);
+      const bool opaque = !inside || maze_cell(maze, loc.x, loc.y) == '#';
+
+      if (inside && i * i + j * j < radius2)
+        fov_set(fov, dx, dy);
+
+      if (blocked) {
+        if (opaque) {
+          next_start = right;
+        } else {
+          blocked = false;
+          start = next_start;
+        }
+      } else if (opaque && j < radius) {
+        // The cells behind this wall are shadowed, light the rest of the next
+        // rows up to it
+        blocked = true;
+        fov_cast(fov, maze, oct, j + 1, start, left);
+        next_start = right;
+      }
+    }
+
+    if (blocked)
+      break;
+  }
+}
+
+// Compute the cells of (maze) visible from (origin)
+// Nothing is done if neither the origin nor the maze changed since the last
+// call.
+//
+// Returns true if the field of view was recomputed
+bool
+fov_update(struct fov* fov, const struct maze* maze, struct location origin)
+{
+  if (fov->valid && fov->origin.x == origin.x && fov->origin.y == origin.y &&
+      fov->generation == maze->generation)
+    return false;
+
+  const size_t side = 2 * (size_t)fov->radius + 1;
+  memset(fov->visible, 0, (side * side + 7) / 8);
+
+  fov->origin = origin;
+  fov->generation = maze->generation;
+  fov->valid = true;
+
+  if (!maze_check_bound_loc(maze, origin))
+    return true;
+
+  fov_set(fov, 0, 0);
+  for (size_t oct = 0; oct < LEN(fov_octants); oct++)
+    fov_cast(fov, maze, fov_octants[oct], 1, 1.0, 0.0);
+
+  return true;
+}
@@ -1,85 +1,368 @@
 #include "game.h"
+#include "path.h"
+#include "troll.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-static const char* default_maze = "#####################################"
-                                  "# #       #       #     #         # #"
-                                  "# # ##### # ### ##### ### ### ### # #"
-                                  "#       #   # #     #     # # #   # #"
-                                  "##### # ##### ##### ### # # # ##### #"
-                                  "#   # #       #     # # # # #     # #"
-                                  "# # ####### # # ##### ### # ##### # #"
-                                  "# #       # # #   #     #     #   # #"
-                                  "# ####### ### ### # ### ##### # ### #"
-                                  "#     #   # #   # #   #     # #     #"
-                                  "# ### ### # ### # ##### # # # #######"
-                                  "#   #   # # #   #   #   # # #   #   #"
-                                  "####### # # # ##### # ### # ### ### #"
-                                  "#     # #     #   # #   # #   #     #"
-                                  "# ### # ##### ### # ### ### ####### #"
-                                  "# #   #     #     #   # # #       # #"
-                                  "# # ##### # ### ##### # # ####### # #"
-                                  "# #     # # # # #     #       # #   #"
-                                  "# ##### # # # ### ##### ##### # #####"
-                                  "# #   # # #     #     # #   #       #"
-                                  "# # ### ### ### ##### ### # ##### # #"
-                                  "# #         #     #       #       # #"
-                                  "#X###################################";
+static const char* default_maze = "#####################################\n"
+                                  "# #       #       #     #         # #\n"
+                                  "# # ##### # ### ##### ### ### ### # #\n"
+                                  "#       #   # #     #     # # #   # #\n"
+                                  "##### # ##### ##### ### # # # ##### #\n"
+                                  "#   # #       #     # # # # #     # #\n"
+                                  "# # ####### # # ##### ### # ##### # #\n"
+                                  "# #       # # #   #     #     #   # #\n"
+                                  "# ####### ### ### # ### ##### # ### #\n"
+                                  "#     #   # #   # #   #     # #     #\n"
+                                  "# ### ### # ### # ##### # # # #######\n"
+                                  "#   #   # # #   #   #   # # #   #   #\n"
+                                  "####### # # # ##### # ### # ### ### #\n"
+                                  "#     # #     #   # #   # #   #     #\n"
+                                  "# ### # ##### ### # ### ### ####### #\n"
+                                  "# #   #     #     #   # # #       # #\n"
+                                  "# # ##### # ### ##### # # ####### # #\n"
+                                  "# #     # # # # #     #       # #   #\n"
+                                  "# ##### # # # ### ##### ##### # #####\n"
+                                  "# #   # # #     #     # #   #       #\n"
+                                  "# # ### ### ### ##### ### # ##### # #\n"
+                                  "# #         #     #       #       # #\n"
+                                  "#X###################################\n";
+
+// Put the trolls and the player of a new game with (seed) on the maze
+static void
+game_populate(struct game* game, uint32_t seed)
+{
+  game->state = GAME_NONE;
+  game->tick = 0;
+  game->seed = seed;
+  rng_seed(&game->rng, seed);
+
+  for (uint32_t i = 0; i < 4; i++)
+    trolls_add(&game->trolls,
+               maze_find_empty_location(&game->maze, &game->rng));
+
+  game_spawn_player(game);
+}
+
+// Set up the game (new_game) on its maze: the trolls, the player and its view
+static struct game*
+game_start(struct game* new_game, uint32_t seed)
+{
+  new_game->player_vision = 10;
+
+  trolls_init(&new_game->trolls, &new_game->maze);
+  new_game->player = entity_new();
+  fov_init(&new_game->vision, new_game->player_vision);
+
+  game_populate(new_game, seed);
+
+  return new_game;
+}
 
 // Initialize a new game
 struct game*
-game_new()
+game_new(const char* maze_path, uint32_t seed)
 {
   struct game* new_game;
   new_game = calloc(1, sizeof(*new_game));
   if (!new_game)
     exit(1);
 
-  new_game->state = GAME_NONE;
-  new_game->player_vision = 10;
-  new_game->maze.maze_width = 37;
-  new_game->maze.maze_height = 23;
+  if (!maze_path) {
+    // put the default maze into the game struct
+    if (maze_load(&new_game->maze, default_maze, strlen(default_maze)) != 1)
+      exit(1);
 
-  // put the default maze into the game struct
-  if (maze_load(&new_game->maze, default_maze, strlen(default_maze)) != 1)
-    exit(1);
+  } else if (maze_open(&new_game->maze, maze_path) != 1) {
+    free(new_game);
+    return NULL;
+  }
+
+  maze_build_rays(&new_game->maze);
+
+  return game_start(new_game, seed);
+}
 
-  new_game->num_trolls = 4;
-  new_game->trolls = calloc(new_game->num_trolls, sizeof(*new_game->trolls));
-  if (!new_game->trolls)
+struct game*
+game_new_shared(const struct maze* maze, uint32_t seed)
+{
+  struct game* new_game = calloc(1, sizeof(*new_game));
+  if (!new_game)
     exit(1);
 
-  for (uint8_t i = 0; i < new_game->num_trolls; i++) {
-    new_game->trolls[i] = entity_new();
-    new_game->trolls[i]->loc = maze_find_empty_location(&new_game->maze);
+  if (!maze_share(&new_game->maze, maze)) {
+    free(new_game);
+    return NULL;
   }
 
-  new_game->player = entity_new();
-  new_game->player->loc = maze_find_empty_location(&new_game->maze);
-
-  return new_game;
+  return game_start(new_game, seed);
 }
 
 void
 game_delete(struct game* game)
 {
-  for (uint8_t i = 0; i < game->num_trolls; i++)
-    entity_delete(&(game->trolls[i]));
+  trolls_destroy(&game->trolls);
   entity_delete(&game->player);
+  fov_destroy(&game->vision);
+  job_pool_delete(&game->jobs);
+  free(game->crossing);
 
   maze_destroy(&game->maze);
-  free(game->trolls);
   free(game);
 }
 
+void
+game_reset(struct game* game, uint32_t seed)
+{
+  trolls_clear(&game->trolls);
+
+  path_delete(game->player->path);
+  game->player->path = NULL;
+  game->player->face = NORTH;
+  game->num_crossing = 0;
+
+  game->vision.valid = false;
+
+  game_populate(game, seed);
+}
+
+void
+game_pool_init(struct game_pool* pool, const struct maze* maze)
+{
+  *pool = (struct game_pool){.maze = maze };
+}
+
+void
+game_pool_destroy(struct game_pool* pool)
+{
+  for (uint32_t i = 0; i < pool->count; i++)
+    game_delete(pool->games[i]);
+  free(pool->games);
+
+  *pool = (struct game_pool){ 0 };
+}
+
+struct game*
+game_pool_get(struct game_pool* pool, uint32_t seed)
+{
+  if (!pool->count) {
+    pool->num_made++;
+    return game_new_shared(pool->maze, seed);
+  }
+
+  struct game* game = pool->games[--pool->count];
+  game_reset(game, seed);
+
+  return game;
+}
+
+void
+game_pool_put(struct game_pool* pool, struct game* game)
+{
+  if (pool->count == pool->capacity) {
+    pool->capacity = pool->capacity ? pool->capacity * 2 : 16;
+    pool->games = realloc(pool->games, pool->capacity * sizeof(*pool->games));
+    if (!pool->games)
+      exit(1);
+  }
+
+  pool->games[pool->count++] = game;
+}
+
+void
+game_set_trolls(struct game* game, uint32_t count)
+{
+  while (game->trolls.count < count)
+    trolls_add(&game->trolls,
+               maze_find_empty_location(&game->maze, &game->rng));
+  while (game->trolls.count > count)
+    trolls_remove(&game->trolls, game->trolls.handle[0]);
+}
+
+// The generator is seeded afresh every tick: a tick then depends on the seed
+// and its number only, not on how many random numbers were drawn before it,
+// and neither checkpoints nor snapshots need to keep its state
+void
+game_begin_tick(struct game* game)
+{
+  rng_seed(&game->rng, ((uint64_t)game->seed << 32 | game->seed) ^ game->tick);
+  game->tick++;
+}
+
+// Put the player on a random empty location, away from the trolls
+// A maze can be packed full of trolls, so we only try so many times.
+void
+game_spawn_player(struct game* game)
+{
+  for (int tries = 0; tries < 64; tries++) {
+    game->player->loc = maze_find_empty_location(&game->maze, &game->rng);
+    if (!occupancy_count(&game->trolls.occupancy, game->player->loc))
+      break;
+  }
+}
+
+// Remember the trolls on the cell the player stepped onto from (from), before
+// they move: one that steps onto (from) swaps cells with the player
+static void
+game_find_crossing(struct game* game, struct location from)
+{
+  const struct trolls* trolls = &game->trolls;
+  const struct location to = game->player->loc;
+
+  game->player_from = from;
+  game->num_crossing = 0;
+
+  if ((from.x == to.x && from.y == to.y) ||
+      !occupancy_count(&trolls->occupancy, to))
+    return;
+
+  for (uint32_t i = 0; i < trolls->count; i++) {
+    if (trolls->loc[i].x != to.x || trolls->loc[i].y != to.y)
+      continue;
+
+    if (game->num_crossing == game->crossing_capacity) {
+      game->crossing_capacity =
+        game->crossing_capacity ? game->crossing_capacity * 2 : 4;
+      game->crossing = realloc(game->crossing, game->crossing_capacity *
+                                                 sizeof(*game->crossing));
+      if (!game->crossing)
+        exit(1);
+    }
+
+    game->crossing[game->num_crossing++] = trolls->handle[i];
+  }
+}
+
+// Returns true if a troll took the cell the player left this tick while the
+// player took its cell
+static bool
+game_crossed(const struct game* game)
+{
+  for (uint32_t i = 0; i < game->num_crossing; i++) {
+    const uint32_t index = trolls_index(&game->trolls, game->crossing[i]);
+    if (index == TROLL_NONE)
+      continue;
+
+    const struct location loc = game->trolls.loc[index];
+    if (loc.x == game->player_from.x && loc.y == game->player_from.y)
+      return true;
+  }
+
+  return false;
+}
+
+// Move the player according to the key (key) pressed
+void
+game_update_player(struct game* game, int32_t key)
+{
+  const struct maze* maze = &game->maze;
+  struct entity* player = game->player;
+  const struct location from = player->loc;
+
+  switch (key) {
+    case 'w':
+    case 'W':
+      entity_move(maze, player, NORTH);
+      break;
+    case 'a':
+    case 'A':
+      entity_move(maze, player, WEST);
+      break;
+    case 's':
+    case 'S':
+      entity_move(maze, player, SOUTH);
+      break;
+    case 'd':
+    case 'D':
+      entity_move(maze, player, EAST);
+      break;
+  }
+
+  game_find_crossing(game, from);
+}
+
+// Update each troll
+void
+game_update_trolls(struct game* game)
+{
+  // The pager of a paged maze is not thread-safe
+  struct job_pool* jobs = game->maze.pager ? NULL : game->jobs;
+
+  game->schedule.focus = game->player->loc;
+  game->schedule.tick = game->tick;
+
+  trolls_update_all(&game->maze, &game->trolls, &game->rng, jobs,
+                    &game->schedule);
+}
+
+void
+game_set_schedule(struct game* game, uint32_t budget, enum trolls_order order)
+{
+  game->schedule.budget = budget;
+  game->schedule.order = order;
+}
+
+void
+game_set_lod(struct game* game, uint32_t radius, uint32_t period)
+{
+  game->schedule.lod_radius = radius;
+  game->schedule.lod_period = period;
+}
+
+void
+game_set_threads(struct game* game, uint32_t num_threads)
+{
+  job_pool_delete(&game->jobs);
+  game->jobs = job_pool_new(num_threads);
+}
+
+// Advance the game by one tick with the player pressing (key)
+void
+game_tick(struct game* game, int32_t key)
+{
+  game_begin_tick(game);
+  game_update_player(game, key);
+  game_update_trolls(game);
+
+  // Check game state (i.e. win or lose)
+  game_get_status(game);
+}
+
+enum game_state
+game_continue(struct game* game)
+{
+  const enum game_state state = game->state;
+
+  if (state != GAME_NONE) {
+    game_spawn_player(game);
+    game->state = GAME_NONE;
+  }
+
+  return state;
+}
+
+uint64_t
+game_hash(const struct game* game)
+{
+  const struct maze* maze = &game->maze;
+
+  uint64_t hash = game->tick;
+  hash = hash * 31 + maze_cell_id(maze, game->player->loc);
+  for (uint32_t i = 0; i < game->trolls.count; i++)
+    hash = hash * 31 + maze_cell_id(maze, game->trolls.loc[i]);
+
+  return hash;
+}
+
 void
 game_get_status(struct game* game)
 {
-  if (MAZE_XY(&game->maze, game->player->loc.x, game->player->loc.y) == 'X')
+  if (maze_cell(&game->maze, game->player->loc.x, game->player->loc.y) == 'X')
     game->state = GAME_WIN;
 
-  // FIXME
-  else if (0)
-    game->state = GAME_NONE;
+  // Caught by a troll, on the cell of the player or on the way to it
+  else if (occupancy_count(&game->trolls.occupancy, game->player->loc) ||
+           game_crossed(game))
+    game->state = GAME_LOSE;
 }
@@ -0,0 +1,303 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "game.h"
+
+/* job_pool runs parallel loops on a fixed set of threads by work stealing
+ *
+ * job_pool_for() splits the loop range evenly over one deque per worker; the
+ * calling thread is worker 0 and helps out until the loop is done. A worker
+ * pops ranges from the bottom of its own deque, and splits them in half,
+ * pushing the upper half back, until they are at most (grain) long. When its
+ * own deque is empty it steals from the top of another worker's deque, where
+ * the largest ranges are, so a worker that runs out of work takes over half
+ * of what a busy one has left.
+ *
+ * Each deque is guarded by its own mutex. The work done under it is tiny next
+ * to the jobs themselves, and it keeps the stealing simple and correct.
+ */
+
+struct job_range
+{
+  size_t begin;
+  size_t end;
+};
+
+struct job_deque
+{
+  pthread_mutex_t lock;
+  struct job_range* ranges; // bottom is ranges[count - 1], top is ranges[0]
+  size_t count;
+  size_t capacity;
+};
+
+struct job_pool
+{
+  uint32_t num_workers; // including the thread calling job_pool_for()
+  pthread_t* threads;
+  struct job_deque* deques;
+
+  // The current loop; workers wait on (wake) until (batch) changes
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t idle;
+  uint64_t batch;
+  uint32_t busy; // helper threads still working on the current batch
+  bool quit;
+
+  job_fn fn;
+  void* ctx;
+  size_t grain;
+  atomic_size_t remaining; // loop iterations not yet run
+};
+
+struct job_worker
+{
+  struct job_pool* pool;
+  uint32_t id;
+};
+
+static void
+job_deque_push(struct job_deque* deque, struct job_range range)
+{
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->count == deque->capacity) {
+    const size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+    struct job_range* ranges =
+      realloc(deque->ranges, capacity * sizeof(*ranges));
+    if (!ranges)
+      exit(1);
+
+    deque->ranges = ranges;
+    deque->capacity = capacity;
+  }
+
+  deque->ranges[deque->count++] = range;
+
+  pthread_mutex_unlock(&deque->lock);
+}
+
+// Take a range from the bottom (the owner) or the top (a thief) of (deque)
+static bool
+job_deque_take(struct job_deque* deque, bool steal, struct job_range* range)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&deque->lock);
+
+  if (deque->count) {
+    found = true;
+    if (steal) {
+      *range = deque->ranges[0];
+      deque->count--;
+      for (size_t i = 0; i < deque->count; i++)
+        deque->ranges[i] = deque->ranges[i + 1];
+    } else {
+      *range = deque->ranges[--deque->count];
+    }
+  }
+
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+// Find a range to work on, our own first
+static bool
+job_pool_next(struct job_pool* pool, uint32_t id, struct job_range* range)
+{
+  if (job_deque_take(&pool->deques[id], false, range))
+    return true;
+
+  for (uint32_t i = 1; i < pool->num_workers; i++) {
+    const uint32_t victim = (id + i) % pool->num_workers;
+    if (job_deque_take(&pool->deques[victim], true, range))
+      return true;
+  }
+
+  return false;
+}
+
+// Work on the current loop until all of it is done
+// When there is nothing to take, the others are still splitting or running
+// their last ranges; keep trying, they may push more.
+static void
+job_pool_work(struct job_pool* pool, uint32_t id)
+{
+  struct job_range range;
+
+  while (atomic_load(&pool->remaining)) {
+    if (!job_pool_next(pool, id, &range)) {
+      sched_yield();
+      continue;
+    }
+
+    // Leave the upper halves for ourselves later, or for thieves
+    while (range.end - range.begin > pool->grain) {
+      const size_t mid = range.begin + (range.end - range.begin) / 2;
+      job_deque_push(&pool->deques[id],
+                     (struct job_range){.begin = mid, .end = range.end });
+      range.end = mid;
+    }
+
+    pool->fn(pool->ctx, range.begin, range.end);
+    atomic_fetch_sub(&pool->remaining, range.end - range.begin);
+  }
+}
+
+static void*
+job_pool_thread(void* arg)
+{
+  struct job_worker* worker = arg;
+  struct job_pool* pool = worker->pool;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->batch == seen)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+
+    if (pool->quit)
+      break;
+
+    seen = pool->batch;
+    pthread_mutex_unlock(&pool->lock);
+
+    job_pool_work(pool, worker->id);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0)
+      pthread_cond_signal(&pool->idle);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  free(worker);
+  return NULL;
+}
+
+// Start a pool of (num_threads) workers, counting the calling thread
+// Returns NULL if (num_threads) is below 2, loops are then better run
+// serially by the caller.
+struct job_pool*
+job_pool_new(uint32_t num_threads)
+{
+  if (num_threads < 2)
+    return NULL;
+
+  struct job_pool* pool = calloc(1, sizeof(*pool));
+  if (!pool)
+    exit(1);
+
+  pool->num_workers = num_threads;
+  pool->threads = calloc(num_threads, sizeof(*pool->threads));
+  pool->deques = calloc(num_threads, sizeof(*pool->deques));
+  if (!pool->threads || !pool->deques)
+    exit(1);
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  atomic_init(&pool->remaining, 0);
+
+  for (uint32_t i = 0; i < num_threads; i++)
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+  for (uint32_t i = 1; i < num_threads; i++) {
+    struct job_worker* worker = malloc(sizeof(*worker));
+    if (!worker)
+      exit(1);
+
+    *worker = (struct job_worker){.pool = pool, .id = i };
+    if (pthread_create(&pool->threads[i], NULL, job_pool_thread, worker))
+      exit(1);
+  }
+
+  return pool;
+}
+
+void
+job_pool_delete(struct job_pool** poolp)
+{
+  struct job_pool* pool = *poolp;
+  if (!pool)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (uint32_t i = 1; i < pool->num_workers; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  for (uint32_t i = 0; i < pool->num_workers; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].ranges);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->idle);
+  free(pool->deques);
+  free(pool->threads);
+  free(pool);
+  *poolp = NULL;
+}
+
+uint32_t
+job_pool_threads(const struct job_pool* pool)
+{
+  return pool ? pool->num_workers : 1;
+}
+
+// Call (fn) on ranges of [0, count), at most (grain) long, in parallel
+// Returns once all of them are done. Without a pool, (fn) is called once on
+// the whole range.
+void
+job_pool_for(struct job_pool* pool, size_t count, size_t grain, job_fn fn,
+             void* ctx)
+{
+  if (!count)
+    return;
+
+  if (!pool) {
+    fn(ctx, 0, count);
+    return;
+  }
+
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->grain = grain ? grain : 1;
+  atomic_store(&pool->remaining, count);
+
+  // An even share for each worker to start with
+  for (uint32_t i = 0; i < pool->num_workers; i++) {
+    const struct job_range range = {
+      .begin = count * i / pool->num_workers,
+      .end = count * (i + 1) / pool->num_workers,
+    };
+    if (range.begin < range.end)
+      job_deque_push(&pool->deques[i], range);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->batch++;
+  pool->busy = pool->num_workers - 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  job_pool_work(pool, 0);
+
+  // The helpers may still be running the last ranges they took
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy)
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
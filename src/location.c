@@ -66,3 +66,27 @@ location_relative(struct location loc1, struct location loc2,
 
   return false;
 }
+
+// Returns the location one step away from (loc) in direction (dir)
+// Stepping off the top or left edge wraps around to a coordinate that is out
+// of bounds for every maze.
+struct location
+location_step(struct location loc, enum direction dir)
+{
+  switch (dir) {
+    case NORTH:
+      loc.y--;
+      break;
+    case SOUTH:
+      loc.y++;
+      break;
+    case EAST:
+      loc.x++;
+      break;
+    case WEST:
+      loc.x--;
+      break;
+  }
+
+  return loc;
+}
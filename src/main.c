@@ -1,69 +1,116 @@
-#include "draw.h"   // for draw_getch, draw_init, draw_maze, draw_player
-#include "game.h"   // for game, entity_move, direction::EAST, direction...
-#include "troll.h"  // for update_trolls
-#include <stdint.h> // for int32_t
+#define _POSIX_C_SOURCE 200809L
+
+#include "draw.h"   // for renderer, draw_renderer, draw_init, draw_show
+#include "game.h"   // for game, game_new, game_tick, recorder_key
+#include <stdint.h> // for uint32_t, uint64_t
+#include <stdio.h>  // for fprintf, stderr
 #include <stdlib.h> // for atexit, exit
+#include <string.h> // for strcmp
+#include <time.h>   // for time, clock_gettime
 
-void player_update(const struct maze* maze, struct entity*, int32_t);
-int main(void);
+int main(int argc, char* argv[]);
 
-void
-player_update(const struct maze* maze, struct entity* player, int32_t key)
+#ifdef DEBUG
+static uint64_t
+main_now(void)
 {
-  switch (key) {
-    case 'w':
-    case 'W':
-      entity_move(maze, player, NORTH);
-      break;
-    case 'a':
-    case 'A':
-      entity_move(maze, player, WEST);
-      break;
-    case 's':
-    case 'S':
-      entity_move(maze, player, SOUTH);
-      break;
-    case 'd':
-    case 'D':
-      entity_move(maze, player, EAST);
-      break;
-  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
 }
+#endif
 
 int
-main(void)
+main(int argc, char* argv[])
 {
-  draw_init();
+  // Record the keys to (log_path) with -r, draw with the renderer named by -d
+  const char* log_path = NULL;
+  const struct renderer* renderer = &draw_ncurses;
+
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    if (strcmp(argv[arg], "-r") == 0)
+      log_path = argv[arg + 1];
+    else if (strcmp(argv[arg], "-d") == 0)
+      renderer = draw_renderer(argv[arg + 1]);
+    else
+      break;
+  }
+
+  if (!renderer || argc - arg > 1 || (arg < argc && argv[arg][0] == '-')) {
+    fprintf(stderr, "usage: %s [-r log] [-d ncurses|ansi|null] [maze]\n",
+            argv[0]);
+    return 1;
+  }
+
+  const uint32_t seed = (uint32_t)time(NULL);
+
+  // Load the maze before the renderer takes over the terminal
+  const char* maze_path = arg < argc ? argv[arg] : NULL;
+  struct game* game = game_new(maze_path, seed);
+  if (!game) {
+    fprintf(stderr, "%s: could not load maze '%s'\n", argv[0], maze_path);
+    return 1;
+  }
+
+  struct recorder rec = { 0 };
+  if (log_path && !recorder_open(&rec, log_path, game, maze_path)) {
+    fprintf(stderr, "%s: could not write '%s'\n", argv[0], log_path);
+    game_delete(game);
+    return 1;
+  }
+
+  draw_init(renderer);
   atexit(draw_cleanup);
 
-  struct game* game = game_new();
+#ifdef DEBUG
+  uint64_t ticks = 0, tick_ns = 0;
+#endif
 
   // Main loop
   while (1) {
 
-    // Draw the game
-    draw_maze(&game->maze);
-    for (uint8_t i = 0; i < game->num_trolls; i++)
-      draw_trolls(game->trolls[i]);
-    draw_player(game->player);
+    // Only recomputed when the player has moved
+    fov_update(&game->vision, &game->maze, game->player->loc);
 
-    // wait for user input
-    int key = draw_getch();
-    player_update(&game->maze, game->player, key);
+    // Hand what the player sees to the render thread, which draws it while
+    // we wait for the key
+    draw_show(game);
 
-    // Update each troll
-    for (uint8_t i = 0; i < game->num_trolls; i++)
-      trolls_update(&game->maze, game->trolls[i]);
+    // wait for user input, then advance the game by one tick
+    int key = renderer->input();
+    if (key == DRAW_EOF)
+      break;
+    if (rec.file)
+      recorder_key(&rec, key);
 
-    // Check game state (i.e. win or lose)
-    game_get_status(game);
+#ifdef DEBUG
+    const uint64_t before = main_now();
+    game_tick(game, key);
+    tick_ns += main_now() - before;
+    ticks++;
+#else
+    game_tick(game, key);
+#endif
 
     if (game->state == GAME_WIN || game->state == GAME_LOSE)
       break;
   }
 
+  draw_stop();
   if (game->state == GAME_LOSE)
-    draw_game_over();
+    renderer->game_over();
+
+#ifdef DEBUG
+  // Off the screen first, for the numbers not to end up on it
+  draw_cleanup();
+  if (ticks)
+    fprintf(stderr, "%llu ticks, %.1f us per tick\n",
+            (unsigned long long)ticks, (double)tick_ns / 1e3 / (double)ticks);
+#endif
+
+  if (rec.file)
+    recorder_close(&rec);
 
   game_delete(game);
 
@@ -1,76 +1,363 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "game.h"
 
-// Load the maze into memory
+// MAZE_TILED tiles are (1 << MAZE_TILE_SHIFT) cells square
+#define MAZE_TILE_SHIFT 3
+#define MAZE_TILE_MASK ((1u << MAZE_TILE_SHIFT) - 1)
+
+void
+maze_destroy(struct maze* maze)
+{
+  if (maze->shared) {
+    *maze = (struct maze){ 0 };
+    return;
+  }
+
+  if (maze->mapping) {
+    // The cells and labels live in the mapping of the binary maze file
+    munmap(maze->mapping, maze->mapping_len);
+  } else if (maze->pager) {
+    maze_pager_delete(&maze->pager);
+  } else {
+    free(maze->maze);
+    free(maze->components);
+  }
+
+  // Snapshots keep the wall distance tables in their mapping as well
+  if (!maze_mapped(maze, maze->rays))
+    free(maze->rays);
+
+  free(maze->exits);
+  free(maze->col_offset);
+  free(maze->row_offset);
+  free(maze->journal);
+
+  *maze = (struct maze){ 0 };
+}
+
 int
-maze_load(struct maze* maze, const char* data, size_t datalen)
+maze_share(struct maze* maze, const struct maze* src)
 {
-  maze->maze = malloc(datalen);
-  if (!maze->maze)
+  if (src->pager)
     return 0;
 
-  memcpy(maze->maze, data, datalen);
+  *maze = *src;
+  maze->shared = src->shared ? src->shared : src;
 
   return 1;
 }
 
+bool
+maze_mapped(const struct maze* maze, const void* ptr)
+{
+  const char* base = maze->mapping;
+  const char* p = ptr;
+
+  return base && p && p >= base && p < base + maze->mapping_len;
+}
+
+// Number of bits needed to count the tiles along a side of (cells) cells
+static uint32_t
+maze_tile_bits(uint32_t cells)
+{
+  const uint32_t tiles =
+    (cells >> MAZE_TILE_SHIFT) + ((cells & MAZE_TILE_MASK) != 0);
+
+  uint32_t bits = 0;
+  while (((uint64_t)1 << bits) < tiles)
+    bits++;
+
+  return bits;
+}
+
+// Spread the bits of (v) out to the even bits of the result
+static size_t
+maze_spread_bits(size_t v)
+{
+  size_t spread = 0;
+  for (uint32_t bit = 0; v >> bit; bit++)
+    spread |= ((v >> bit) & 1) << (2 * bit);
+
+  return spread;
+}
+
+size_t
+maze_size(const struct maze* maze)
+{
+  if (maze->layout == MAZE_LINEAR)
+    return (size_t)maze->maze_width * maze->maze_height;
+
+  const uint32_t bits =
+    maze_tile_bits(maze->maze_width) + maze_tile_bits(maze->maze_height);
+
+  return (size_t)1 << (bits + 2 * MAZE_TILE_SHIFT);
+}
+
+// Build the offset tables used by maze_index() for tiled mazes
+//
+// The tile (tx, ty) is number morton(tx, ty) in memory. When the tile grid is
+// not square, only the low bits of the shorter side are interleaved and the
+// remaining high bits of the longer side go on top, so the tiles still fill
+// a power of two sized range without padding the grid out to a square.
 void
-maze_destroy(struct maze* maze)
+maze_init_layout(struct maze* maze, enum maze_layout layout)
+{
+  free(maze->col_offset);
+  free(maze->row_offset);
+  maze->col_offset = NULL;
+  maze->row_offset = NULL;
+
+  maze->layout = layout;
+  if (layout == MAZE_LINEAR)
+    return;
+
+  const uint32_t bits_x = maze_tile_bits(maze->maze_width);
+  const uint32_t bits_y = maze_tile_bits(maze->maze_height);
+  const uint32_t shared = bits_x < bits_y ? bits_x : bits_y;
+  const size_t low = ((size_t)1 << shared) - 1;
+
+  maze->col_offset = malloc(maze->maze_width * sizeof(*maze->col_offset));
+  maze->row_offset = malloc(maze->maze_height * sizeof(*maze->row_offset));
+  if (!maze->col_offset || !maze->row_offset)
+    exit(1);
+
+  for (uint32_t x = 0; x < maze->maze_width; x++) {
+    const size_t tile = x >> MAZE_TILE_SHIFT;
+    const size_t code =
+      maze_spread_bits(tile & low) | (tile >> shared) << (2 * shared);
+    maze->col_offset[x] = code << (2 * MAZE_TILE_SHIFT) | (x & MAZE_TILE_MASK);
+  }
+
+  for (uint32_t y = 0; y < maze->maze_height; y++) {
+    const size_t tile = y >> MAZE_TILE_SHIFT;
+    const size_t code =
+      maze_spread_bits(tile & low) << 1 | (tile >> shared) << (2 * shared);
+    maze->row_offset[y] = code << (2 * MAZE_TILE_SHIFT) |
+                          (y & MAZE_TILE_MASK) << MAZE_TILE_SHIFT;
+  }
+}
+
+int
+maze_set_layout(struct maze* maze, enum maze_layout layout)
+{
+  if (maze->layout == layout)
+    return 1;
+
+  if (maze->mapping || maze->pager || maze->shared)
+    return 0;
+
+  // (old) keeps the cells and offset tables of the current layout
+  const struct maze old = *maze;
+  maze->col_offset = NULL;
+  maze->row_offset = NULL;
+  maze_init_layout(maze, layout);
+
+  const size_t size = maze_size(maze);
+  char* cells = malloc(size);
+  if (!cells)
+    exit(1);
+
+  // Padding is filled with walls
+  memset(cells, '#', size);
+
+  for (uint32_t y = 0; y < maze->maze_height; y++)
+    for (uint32_t x = 0; x < maze->maze_width; x++)
+      cells[maze_index(maze, x, y)] = maze_cell(&old, x, y);
+
+  free(old.maze);
+  free(old.col_offset);
+  free(old.row_offset);
+  maze->maze = cells;
+
+  // The tables follow the layout of the cells
+  if (maze->rays)
+    maze_build_rays(maze);
+
+  return 1;
+}
+
+bool
+maze_exits_valid(uint32_t width, uint32_t height, const uint32_t* exits,
+                 uint32_t num_exits)
+{
+  const uint64_t cells = (uint64_t)width * height;
+  for (uint32_t i = 0; i < num_exits; i++)
+    if (exits[i] >= cells || (i && exits[i] <= exits[i - 1]))
+      return false;
+
+  return true;
+}
+
+// Keep maze->exits sorted as exits come and go
+static void
+maze_update_exits(struct maze* maze, uint32_t cell, char old_cell,
+                  char new_cell)
+{
+  // position of (cell) in the exit list
+  uint32_t i = 0;
+  while (i < maze->num_exits && maze->exits[i] < cell)
+    i++;
+
+  // A list that does not match the cells may lack (cell), or have it already
+  const bool listed = i < maze->num_exits && maze->exits[i] == cell;
+
+  if (old_cell == 'X' && listed) {
+    maze->num_exits--;
+    memmove(&maze->exits[i], &maze->exits[i + 1],
+            (maze->num_exits - i) * sizeof(*maze->exits));
+  }
+
+  if (new_cell == 'X' && !listed) {
+    uint32_t* exits =
+      realloc(maze->exits, (maze->num_exits + 1) * sizeof(*maze->exits));
+    if (!exits)
+      exit(1);
+
+    maze->exits = exits;
+    memmove(&maze->exits[i + 1], &maze->exits[i],
+            (maze->num_exits - i) * sizeof(*maze->exits));
+    maze->exits[i] = cell;
+    maze->num_exits++;
+  }
+}
+
+// Change the cell (x, y) of the maze to (cell)
+//
+// Every change bumps maze->generation and is recorded in the journal, so
+// anything derived from the maze can catch up by replaying the changes since
+// the generation it last saw (see maze_journal_get()).
+// The wall distance tables are patched right away. The connected region labels
+// cannot be patched that way and are dropped when a wall appears or
+// disappears.
+//
+// Returns 1 if the cell was changed (or already held (cell))
+// Returns 0 if (x, y) is out of bounds, (cell) is not one of '#', ' ' or 'X',
+// or the maze is paged (read-only)
+int
+maze_set_cell(struct maze* maze, uint32_t x, uint32_t y, char cell)
+{
+  const struct location loc = {.x = x, .y = y };
+
+  if (!maze_check_bound_loc(maze, loc) || maze->pager || maze->shared)
+    return 0;
+
+  if (cell != '#' && cell != ' ' && cell != 'X')
+    return 0;
+
+  char* target = &maze->maze[maze_index(maze, x, y)];
+  const char old_cell = *target;
+  if (old_cell == cell)
+    return 1;
+
+  if (!maze->journal) {
+    maze->journal = malloc(MAZE_JOURNAL_LENGTH * sizeof(*maze->journal));
+    if (!maze->journal)
+      exit(1);
+  }
+
+  *target = cell;
+
+  if (old_cell == 'X' || cell == 'X')
+    maze_update_exits(maze, maze_cell_id(maze, loc), old_cell, cell);
+
+  if (old_cell == '#' || cell == '#') {
+    maze_update_rays(maze, loc);
+
+    if (maze->components) {
+      if (!maze->mapping)
+        free(maze->components);
+      maze->components = NULL;
+    }
+  }
+
+  maze->journal[maze->generation % MAZE_JOURNAL_LENGTH] =
+    (struct maze_change){.cell = maze_cell_id(maze, loc),
+                         .old_cell = old_cell,
+                         .new_cell = cell };
+  maze->generation++;
+
+  return 1;
+}
+
+// Returns the change that brought the maze to generation (generation)
+// Returns NULL if there is no such change, or if it is so old that it has
+// already been overwritten in the journal. Anything that is that far behind
+// has to be rebuilt from the maze instead.
+const struct maze_change*
+maze_journal_get(const struct maze* maze, uint64_t generation)
 {
-  free(maze->maze);
-  maze->maze = NULL;
+  if (generation == 0 || generation > maze->generation ||
+      maze->generation - generation >= MAZE_JOURNAL_LENGTH)
+    return NULL;
+
+  return &maze->journal[(generation - 1) % MAZE_JOURNAL_LENGTH];
 }
 
 // Find a random empty location on the maze
+// Cells are drawn at random until one is empty, a batch of them at a time:
+// every empty cell is as likely as any other to come up.
 struct location
-maze_find_empty_location(const struct maze* maze)
-{
-  // random (x, y) location
-  uint16_t check_x = 0, check_y = 0;
-  bool spot_found = false;
-
-  do {
-    // pick a random y value
-    check_y = rand() % maze->maze_height;
-    check_x = 0;
-
-    // count the number of empty columns on the row
-    uint8_t empty_columns = 1;
-    for (uint8_t i = 0; i < maze->maze_width; i++)
-      if (MAZE_XY(maze, i, check_y) == ' ')
-        empty_columns++;
-
-    // pick a random available column
-    uint8_t get_col = rand() % empty_columns;
-
-    // pick the (get_col) empty column
-    for (uint8_t i = 0; i < maze->maze_width && get_col; i++) {
-      // decrement get_col if we find an empty space
-      if (MAZE_XY(maze, i, check_y) == ' ')
-        get_col--;
-
-      if (!get_col)
-        check_x = i;
-    }
+maze_find_empty_location(const struct maze* maze, struct rng* rng)
+{
+  uint32_t xs[8], ys[8];
 
-    if (MAZE_XY(maze, check_x, check_y) == ' ')
-      spot_found = true;
+  for (;;) {
+    rng_fill_below(rng, xs, 8, maze->maze_width);
+    rng_fill_below(rng, ys, 8, maze->maze_height);
+
+    for (size_t k = 0; k < 8; k++)
+      if (maze_cell(maze, xs[k], ys[k]) == ' ')
+        return (struct location){.x = xs[k], .y = ys[k] };
+  }
+}
 
-  } while (!spot_found);
+// Returns a random empty location at most (radius) cells from (center) in x and
+// y, that can be reached from it. After a few misses, any empty location.
+struct location
+maze_find_empty_location_near(const struct maze* maze, struct rng* rng,
+                              struct location center, uint32_t radius)
+{
+  const uint32_t min_x = center.x > radius ? center.x - radius : 0;
+  const uint32_t min_y = center.y > radius ? center.y - radius : 0;
+  const uint32_t max_x = radius < maze->maze_width - 1 - center.x
+                           ? center.x + radius
+                           : maze->maze_width - 1;
+  const uint32_t max_y = radius < maze->maze_height - 1 - center.y
+                           ? center.y + radius
+                           : maze->maze_height - 1;
+
+  for (int tries = 0; tries < 64; tries++) {
+    const struct location loc = {
+      .x = min_x + rng_below(rng, max_x - min_x + 1),
+      .y = min_y + rng_below(rng, max_y - min_y + 1),
+    };
+
+    if (maze_cell(maze, loc.x, loc.y) != ' ')
+      continue;
+    if (maze->components && maze->components[maze_cell_id(maze, loc)] !=
+                              maze->components[maze_cell_id(maze, center)])
+      continue;
+
+    return loc;
+  }
 
-  return (struct location){.x = check_x, .y = check_y };
+  return maze_find_empty_location(maze, rng);
 }
 
 /* Pick a random empty entity for the entity */
 int
-maze_random_spawn(const struct maze* maze, struct entity* entity)
+maze_random_spawn(const struct maze* maze, struct rng* rng,
+                  struct entity* entity)
 {
-  entity->face = rand() % 4;
-  entity->loc = maze_find_empty_location(maze);
+  entity->face = (enum direction)rng_below(rng, 4);
+  entity->loc = maze_find_empty_location(maze, rng);
   return 1;
 }
 
@@ -78,24 +365,24 @@ bool
 maze_is_empty_space(const struct maze* maze, struct entity* entity,
                     enum direction dir)
 {
-  uint16_t x, y;
+  uint32_t x, y;
   x = entity->loc.x;
   y = entity->loc.y;
 
   if (dir == NORTH) {
-    if (maze_check_bound(maze, y - 1, dir) && MAZE_XY(maze, x, y - 1) != '#')
+    if (maze_check_bound(maze, y - 1, dir) && maze_cell(maze, x, y - 1) != '#')
       return true;
 
   } else if (dir == SOUTH) {
-    if (maze_check_bound(maze, y + 1, dir) && MAZE_XY(maze, x, y + 1) != '#')
+    if (maze_check_bound(maze, y + 1, dir) && maze_cell(maze, x, y + 1) != '#')
       return true;
 
   } else if (dir == EAST) {
-    if (maze_check_bound(maze, x + 1, dir) && MAZE_XY(maze, x + 1, y) != '#')
+    if (maze_check_bound(maze, x + 1, dir) && maze_cell(maze, x + 1, y) != '#')
       return true;
 
   } else if (dir == WEST) {
-    if (maze_check_bound(maze, x - 1, dir) && MAZE_XY(maze, x - 1, y) != '#')
+    if (maze_check_bound(maze, x - 1, dir) && maze_cell(maze, x - 1, y) != '#')
       return true;
   }
 
@@ -106,24 +393,26 @@ bool
 maze_is_empty_space_loc(const struct maze* maze, struct location loc)
 {
   return (maze_check_bound_loc(maze, loc) &&
-          MAZE_XY(maze, loc.x, loc.y) == ' ');
+          maze_cell(maze, loc.x, loc.y) == ' ');
 }
 
 // Make sure we're in bounds
+// Stepping below 0 wraps around to a large value, so only the upper bound
+// needs checking.
 bool
-maze_check_bound(const struct maze* maze, uint16_t value, enum direction dir)
+maze_check_bound(const struct maze* maze, uint32_t value, enum direction dir)
 {
   switch (dir) {
     case NORTH:
     case SOUTH:
-      if (value >= maze->maze_height
-          /* || value < 0 */)
+      if (value >= maze->maze_height)
         return false;
+      break;
     case EAST:
     case WEST:
-      if (value >= maze->maze_width
-          /* || value < 0 */)
+      if (value >= maze->maze_width)
         return false;
+      break;
   }
 
   return true;
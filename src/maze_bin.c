@@ -0,0 +1,365 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "game.h"
+
+/* Binary maze format
+ *
+ * The file is laid out so that it can be mapped and used in place:
+ *
+ *   header       struct maze_bin_header
+ *   cells        maze_size() bytes in the layout of the maze (row-major, or
+ *                tiled with MAZE_BIN_TILED), starting on a page boundary
+ *   exits        num_exits * uint32_t cell ids, copied into memory on load so
+ *                maze_set_cell() can add and remove exits
+ *   components   width * height uint32_t labels by cell id
+ *                (MAZE_BIN_COMPONENTS only)
+ *
+ * Every section starts on an 8 byte boundary and all values are stored in
+ * host byte order; the magic doubles as a byte order check.
+ */
+#define MAZE_BIN_MAGIC 0x4d4c5254 // "TRLM" read as a little-endian uint32_t
+#define MAZE_BIN_VERSION 2
+#define MAZE_BIN_PAGE 4096
+
+enum maze_bin_flags
+{
+  MAZE_BIN_COMPONENTS = 1 << 0,
+  MAZE_BIN_TILED = 1 << 1,
+};
+
+struct maze_bin_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t width;
+  uint32_t height;
+  uint32_t num_exits;
+  uint64_t cells_offset;
+  uint64_t exits_offset;
+  uint64_t components_offset;
+  uint64_t size; // size of the whole file
+};
+
+static uint64_t
+maze_bin_align(uint64_t offset, uint64_t align)
+{
+  return (offset + align - 1) & ~(align - 1);
+}
+
+// Compute where each section of (maze) goes in the file
+static struct maze_bin_header
+maze_bin_layout(const struct maze* maze)
+{
+  const uint64_t cells = (uint64_t)maze->maze_width * maze->maze_height;
+  const uint64_t size = maze_size(maze);
+
+  struct maze_bin_header header = {
+    .magic = MAZE_BIN_MAGIC,
+    .version = MAZE_BIN_VERSION,
+    .width = maze->maze_width,
+    .height = maze->maze_height,
+    .num_exits = maze->num_exits,
+  };
+
+  if (maze->layout == MAZE_TILED)
+    header.flags |= MAZE_BIN_TILED;
+
+  header.cells_offset = maze_bin_align(sizeof(header), MAZE_BIN_PAGE);
+  header.exits_offset = maze_bin_align(header.cells_offset + size, 8);
+  header.size =
+    header.exits_offset + (uint64_t)maze->num_exits * sizeof(*maze->exits);
+
+  if (maze->components) {
+    header.flags |= MAZE_BIN_COMPONENTS;
+    header.components_offset = maze_bin_align(header.size, 8);
+    header.size =
+      header.components_offset + cells * sizeof(*maze->components);
+  }
+
+  return header;
+}
+
+// Write (len) bytes of (data) at (offset), zero filling any gap
+static int
+maze_bin_write(FILE* file, uint64_t* pos, uint64_t offset, const void* data,
+               size_t len)
+{
+  for (; *pos < offset; (*pos)++)
+    if (fputc(0, file) == EOF)
+      return 0;
+
+  if (len && fwrite(data, 1, len, file) != len)
+    return 0;
+
+  *pos += len;
+  return 1;
+}
+
+// Save (maze) to (path) in the binary format
+// Component labels are included if they have been computed for the maze.
+//
+// Returns 1 on success, 0 on failure
+int
+maze_save(const struct maze* maze, const char* path)
+{
+  const struct maze_bin_header header = maze_bin_layout(maze);
+  const size_t cells = (size_t)maze->maze_width * maze->maze_height;
+  const size_t size = maze_size(maze);
+
+  if (maze->pager)
+    return 0;
+
+  FILE* file = fopen(path, "wb");
+  if (!file)
+    return 0;
+
+  uint64_t pos = 0;
+  int ok = maze_bin_write(file, &pos, 0, &header, sizeof(header)) &&
+           maze_bin_write(file, &pos, header.cells_offset, maze->maze, size) &&
+           maze_bin_write(file, &pos, header.exits_offset, maze->exits,
+                          maze->num_exits * sizeof(*maze->exits));
+
+  if (ok && maze->components)
+    ok = maze_bin_write(file, &pos, header.components_offset,
+                        maze->components, cells * sizeof(*maze->components));
+
+  if (fclose(file) != 0)
+    ok = 0;
+
+  return ok;
+}
+
+// Make sure (len) bytes at (offset), aligned to (align), lie within the file
+// of (header), without any sum that could wrap around
+static bool
+maze_bin_section(const struct maze_bin_header* header, uint64_t offset,
+                 uint64_t len, uint64_t align)
+{
+  return offset % align == 0 && offset >= sizeof(*header) &&
+         offset <= header->size && len <= header->size - offset;
+}
+
+// Make sure the header describes a file we can use in place
+static bool
+maze_bin_valid(const struct maze_bin_header* header, uint64_t size)
+{
+  const uint64_t cells = (uint64_t)header->width * header->height;
+  const struct maze shape = {
+    .maze_width = header->width,
+    .maze_height = header->height,
+    .layout = header->flags & MAZE_BIN_TILED ? MAZE_TILED : MAZE_LINEAR,
+  };
+
+  if (header->magic != MAZE_BIN_MAGIC || header->version != MAZE_BIN_VERSION)
+    return false;
+
+  if (header->size != size || !cells || header->width > MAZE_MAX_SIDE ||
+      header->height > MAZE_MAX_SIDE)
+    return false;
+
+  return maze_bin_section(header, header->cells_offset, maze_size(&shape),
+                          MAZE_BIN_PAGE) &&
+         maze_bin_section(header, header->exits_offset,
+                          (uint64_t)header->num_exits * sizeof(uint32_t), 8) &&
+         (!(header->flags & MAZE_BIN_COMPONENTS) ||
+          maze_bin_section(header, header->components_offset,
+                           cells * sizeof(uint32_t), 8));
+}
+
+// Read and check the header of the binary maze in (fd)
+static int
+maze_bin_read_header(int fd, struct maze_bin_header* header)
+{
+  struct stat st;
+
+  return fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(*header) &&
+         pread(fd, header, sizeof(*header), 0) == sizeof(*header) &&
+         maze_bin_valid(header, (uint64_t)st.st_size);
+}
+
+// Map the binary maze at (path) into memory
+// The maze points straight into the mapping, so every process that maps the
+// same file shares its pages. The mapping is private: writes to the maze are
+// copy-on-write and never reach the file.
+//
+// Returns 1 on success, 0 if the file cannot be mapped or is not a binary maze
+int
+maze_map(struct maze* maze, const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct maze_bin_header header;
+  if (!maze_bin_read_header(fd, &header)) {
+    close(fd);
+    return 0;
+  }
+
+  char* base = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED)
+    return 0;
+
+  *maze = (struct maze){
+    .maze = base + header.cells_offset,
+    .maze_width = header.width,
+    .maze_height = header.height,
+    .num_exits = header.num_exits,
+    .mapping = base,
+    .mapping_len = header.size,
+  };
+
+  if (header.num_exits) {
+    maze->exits = malloc(header.num_exits * sizeof(*maze->exits));
+    if (!maze->exits)
+      exit(1);
+    memcpy(maze->exits, base + header.exits_offset,
+           header.num_exits * sizeof(*maze->exits));
+
+    if (!maze_exits_valid(header.width, header.height, maze->exits,
+                          header.num_exits)) {
+      free(maze->exits);
+      munmap(base, header.size);
+      *maze = (struct maze){ 0 };
+      return 0;
+    }
+  }
+
+  if (header.flags & MAZE_BIN_COMPONENTS)
+    maze->components = (uint32_t*)(void*)(base + header.components_offset);
+
+  if (header.flags & MAZE_BIN_TILED)
+    maze_init_layout(maze, MAZE_TILED);
+
+  return 1;
+}
+
+// Open the binary maze at (path) with its cells paged in on demand
+// Only the header and the exits are read up front; component labels are not
+// loaded since they would take four times the memory of the cells.
+//
+// Returns 1 on success, 0 if the file cannot be opened or is not a binary maze
+int
+maze_map_paged(struct maze* maze, const char* path, uint32_t max_chunks)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct maze_bin_header header;
+  if (!maze_bin_read_header(fd, &header)) {
+    close(fd);
+    return 0;
+  }
+
+  // The exits only go into (maze) once they are read and checked, for a
+  // failed open to leave nothing in it to free
+  uint32_t* exits = NULL;
+  const size_t exits_size = header.num_exits * sizeof(*exits);
+  if (exits_size) {
+    exits = malloc(exits_size);
+    if (!exits)
+      exit(1);
+
+    if (pread(fd, exits, exits_size, (off_t)header.exits_offset) !=
+          (ssize_t)exits_size ||
+        !maze_exits_valid(header.width, header.height, exits,
+                          header.num_exits)) {
+      free(exits);
+      close(fd);
+      return 0;
+    }
+  }
+
+  *maze = (struct maze){
+    .maze_width = header.width,
+    .maze_height = header.height,
+    .exits = exits,
+    .num_exits = header.num_exits,
+  };
+
+  maze_init_layout(maze,
+                   header.flags & MAZE_BIN_TILED ? MAZE_TILED : MAZE_LINEAR);
+
+  // The pager owns (fd) from here on
+  maze->pager = maze_pager_new(fd, header.cells_offset, maze_size(maze),
+                               max_chunks);
+
+  return 1;
+}
+
+// Open the maze at (path), either a binary maze or a text maze
+int
+maze_open(struct maze* maze, const char* path)
+{
+  return maze_map(maze, path) || maze_load_file(maze, path);
+}
+
+// Label every open cell with the connected region it belongs to
+// Walls are labelled 0 and regions are numbered from 1 in row-major order of
+// their first cell. Two cells with different labels can never reach each
+// other.
+//
+// Mapped mazes are left alone, their labels (if any) come from the file.
+void
+maze_label_components(struct maze* maze)
+{
+  if (maze->mapping)
+    return;
+
+  const uint32_t cells = maze->maze_width * maze->maze_height;
+
+  uint32_t* labels = calloc(cells, sizeof(*labels));
+  uint32_t* queue = malloc(cells * sizeof(*queue));
+  if (!labels || !queue)
+    exit(1);
+
+  uint32_t label = 0;
+  for (uint32_t start = 0; start < cells; start++) {
+    const struct location loc = maze_cell_loc(maze, start);
+    if (labels[start] || maze_cell(maze, loc.x, loc.y) == '#')
+      continue;
+
+    // Flood fill the region from (start)
+    uint32_t head = 0, tail = 0;
+    labels[start] = ++label;
+    queue[tail++] = start;
+
+    while (head < tail) {
+      const struct location cur = maze_cell_loc(maze, queue[head++]);
+
+      for (enum direction dir = NORTH; dir <= WEST; dir++) {
+        const struct location adj = location_step(cur, dir);
+        if (!maze_check_bound_loc(maze, adj) ||
+            maze_cell(maze, adj.x, adj.y) == '#')
+          continue;
+
+        const uint32_t id = maze_cell_id(maze, adj);
+        if (labels[id])
+          continue;
+
+        labels[id] = label;
+        queue[tail++] = id;
+      }
+    }
+  }
+
+  free(queue);
+
+  free(maze->components);
+  maze->components = labels;
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "game.h"
+
+int main(int argc, char* argv[]);
+
+static void
+usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-c] [-t] <maze.txt> <maze.bin>\n", prog);
+  fprintf(stderr, "  -c  include connected region labels\n");
+  fprintf(stderr, "  -t  store the cells in the tiled layout\n");
+}
+
+// Convert a text maze to the binary format that maze_map() loads
+int
+main(int argc, char* argv[])
+{
+  int arg = 1;
+  int components = 0;
+  enum maze_layout layout = MAZE_LINEAR;
+
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    if (strcmp(argv[arg], "-c") == 0) {
+      components = 1;
+    } else if (strcmp(argv[arg], "-t") == 0) {
+      layout = MAZE_TILED;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - arg != 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct maze maze;
+  if (!maze_load_file(&maze, argv[arg])) {
+    fprintf(stderr, "%s: could not load maze '%s'\n", argv[0], argv[arg]);
+    return 1;
+  }
+
+  if (components)
+    maze_label_components(&maze);
+
+  maze_set_layout(&maze, layout);
+
+  int ok = maze_save(&maze, argv[arg + 1]);
+  if (!ok)
+    fprintf(stderr, "%s: could not write '%s'\n", argv[0], argv[arg + 1]);
+
+  maze_destroy(&maze);
+
+  return ok ? 0 : 1;
+}
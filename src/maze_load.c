@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "game.h"
+
+// Number of bytes read from a level file at a time
+#define MAZE_CHUNK (1 << 16)
+
+/* maze_parser holds the state of a text maze while it is streamed in.
+ * Rows may be split across chunks, so the position within the current row is
+ * carried between calls to maze_parse_chunk().
+ *
+ * Cells are appended to maze->maze as they are classified; the width is taken
+ * from the first row and every following row must match it.
+ */
+struct maze_parser
+{
+  struct maze* maze;
+  size_t len;      // number of cells written to maze->maze
+  size_t capacity; // allocated size of maze->maze
+  size_t exits_capacity;
+  size_t col;    // number of cells seen on the current row
+  size_t line;   // current line of the input, for error messages
+  bool finished; // a blank line ended the maze, only blank lines may follow
+  bool cr;       // the last byte was a '\r', which must end the row
+};
+
+static int
+maze_parse_error(const struct maze_parser* p, const char* msg)
+{
+#ifdef DEBUG
+  fprintf(stderr, "maze:%zu:%zu: %s\n", p->line, p->col + 1, msg);
+#else
+  (void)p;
+  (void)msg;
+#endif
+  return 0;
+}
+
+// Returns the length of the run of plain cells ('#' and ' ') at the start of
+// (data). Anything else (newlines, exits, invalid bytes) ends the run and is
+// handled one byte at a time by the caller.
+static size_t
+maze_scan_plain(const char* data, size_t len)
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i wall = _mm256_set1_epi8('#');
+  const __m256i empty = _mm256_set1_epi8(' ');
+
+  for (; i + 32 <= len; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    const __m256i plain = _mm256_or_si256(_mm256_cmpeq_epi8(v, wall),
+                                          _mm256_cmpeq_epi8(v, empty));
+    const uint32_t other = ~(uint32_t)_mm256_movemask_epi8(plain);
+    if (other)
+      return i + (size_t)__builtin_ctz(other);
+  }
+#elif defined(__SSE2__)
+  const __m128i wall = _mm_set1_epi8('#');
+  const __m128i empty = _mm_set1_epi8(' ');
+
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    const __m128i plain =
+      _mm_or_si128(_mm_cmpeq_epi8(v, wall), _mm_cmpeq_epi8(v, empty));
+    const uint32_t other = ~(uint32_t)_mm_movemask_epi8(plain) & 0xffff;
+    if (other)
+      return i + (size_t)__builtin_ctz(other);
+  }
+#endif
+
+  for (; i < len; i++)
+    if (data[i] != '#' && data[i] != ' ')
+      break;
+
+  return i;
+}
+
+static void
+maze_parser_append(struct maze_parser* p, const char* cells, size_t n)
+{
+  if (p->len + n > p->capacity) {
+    size_t capacity = p->capacity ? p->capacity * 2 : 4096;
+    while (capacity < p->len + n)
+      capacity *= 2;
+
+    char* grown = realloc(p->maze->maze, capacity);
+    if (!grown)
+      exit(1);
+
+    p->maze->maze = grown;
+    p->capacity = capacity;
+  }
+
+  memcpy(p->maze->maze + p->len, cells, n);
+  p->len += n;
+  p->col += n;
+}
+
+static void
+maze_parser_add_exit(struct maze_parser* p)
+{
+  struct maze* maze = p->maze;
+
+  if (maze->num_exits == p->exits_capacity) {
+    size_t capacity = p->exits_capacity ? p->exits_capacity * 2 : 8;
+
+    uint32_t* grown = realloc(maze->exits, capacity * sizeof(*maze->exits));
+    if (!grown)
+      exit(1);
+
+    maze->exits = grown;
+    p->exits_capacity = capacity;
+  }
+
+  // Cells are stored row-major as they come in, so the next one written is
+  // the cell id of the exit
+  maze->exits[maze->num_exits++] = (uint32_t)p->len;
+}
+
+static int
+maze_parser_end_row(struct maze_parser* p)
+{
+  struct maze* maze = p->maze;
+
+  // Blank lines before the maze are skipped, after it they end the maze
+  if (p->col == 0) {
+    if (maze->maze_width)
+      p->finished = true;
+    return 1;
+  }
+
+  if (!maze->maze_width) {
+    maze->maze_width = p->col;
+  } else if (p->col != maze->maze_width) {
+    return maze_parse_error(p, "row length does not match the first row");
+  }
+
+  if (maze->maze_height == MAZE_MAX_SIDE)
+    return maze_parse_error(p, "too many rows");
+
+  maze->maze_height++;
+  p->col = 0;
+
+  return 1;
+}
+
+// Classify and store every byte of (data)
+// Returns 0 if the data is not a valid maze
+static int
+maze_parse_chunk(struct maze_parser* p, const char* data, size_t len)
+{
+  while (len) {
+    // A '\r' is only stripped right before a '\n', which may start the next
+    // chunk
+    if (p->cr && *data != '\n')
+      return maze_parse_error(p, "'\\r' not at the end of a row");
+
+    const size_t run = maze_scan_plain(data, len);
+
+    if (run) {
+      if (p->finished)
+        return maze_parse_error(p, "cells after a blank line");
+
+      maze_parser_append(p, data, run);
+      if (p->col > MAZE_MAX_SIDE)
+        return maze_parse_error(p, "row is too long");
+
+      data += run;
+      len -= run;
+      if (!len)
+        break;
+    }
+
+    switch (*data) {
+      case '\n':
+        if (!maze_parser_end_row(p))
+          return 0;
+        p->line++;
+        p->cr = false;
+        break;
+
+      case '\r':
+        p->cr = true;
+        break;
+
+      case 'X':
+        if (p->finished)
+          return maze_parse_error(p, "cells after a blank line");
+
+        maze_parser_add_exit(p);
+        maze_parser_append(p, data, 1);
+        if (p->col > MAZE_MAX_SIDE)
+          return maze_parse_error(p, "row is too long");
+        break;
+
+      default:
+        return maze_parse_error(p, "invalid cell, expected '#', ' ' or 'X'");
+    }
+
+    data++;
+    len--;
+  }
+
+  return 1;
+}
+
+static void
+maze_parser_init(struct maze_parser* p, struct maze* maze)
+{
+  *p = (struct maze_parser){.maze = maze, .line = 1 };
+  *maze = (struct maze){ 0 };
+}
+
+// Terminate the last row and make sure we ended up with a maze
+static int
+maze_parser_finish(struct maze_parser* p, int ok)
+{
+  if (ok && p->cr)
+    ok = maze_parse_error(p, "'\\r' not at the end of a row");
+
+  if (ok && p->col)
+    ok = maze_parser_end_row(p);
+
+  if (ok && (!p->maze->maze_width || !p->maze->maze_height))
+    ok = maze_parse_error(p, "no maze found");
+
+  if (!ok)
+    maze_destroy(p->maze);
+
+  return ok;
+}
+
+// Load the maze in (data) of length (datalen) into memory
+// The width and height of the maze are taken from the text.
+//
+// Returns 1 on success, 0 if the data is not a valid maze
+int
+maze_load(struct maze* maze, const char* data, size_t datalen)
+{
+  struct maze_parser p;
+  maze_parser_init(&p, maze);
+
+  return maze_parser_finish(&p, maze_parse_chunk(&p, data, datalen));
+}
+
+// Load a maze from the stream (file) one chunk at a time
+//
+// Returns 1 on success, 0 on read errors or if the stream is not a valid maze
+int
+maze_load_stream(struct maze* maze, FILE* file)
+{
+  struct maze_parser p;
+  maze_parser_init(&p, maze);
+
+  char* chunk = malloc(MAZE_CHUNK);
+  if (!chunk)
+    exit(1);
+
+  int ok = 1;
+  size_t nread;
+  while (ok && (nread = fread(chunk, 1, MAZE_CHUNK, file)) > 0)
+    ok = maze_parse_chunk(&p, chunk, nread);
+
+  if (ok && ferror(file))
+    ok = maze_parse_error(&p, "read error");
+
+  free(chunk);
+
+  return maze_parser_finish(&p, ok);
+}
+
+// Load the maze stored in the text file at (path)
+int
+maze_load_file(struct maze* maze, const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return 0;
+
+  // We already read in large chunks, skip the extra copy through stdio
+  setvbuf(file, NULL, _IONBF, 0);
+
+  int ok = maze_load_stream(maze, file);
+  fclose(file);
+
+  return ok;
+}
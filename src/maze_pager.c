@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "game.h"
+
+/* maze_pager keeps a window of a binary maze file in memory
+ *
+ * The cell section of the file is split into fixed-size chunks that are
+ * mapped the first time a cell inside them is read. Once (max_resident)
+ * chunks are mapped, the least recently used one is unmapped to make room.
+ *
+ * With the tiled layout a chunk is a square block of cells, so an entity only
+ * keeps the few chunks around it resident, however large the maze is.
+ *
+ * Mappings start on a page of the host, which need not be where a chunk
+ * starts: the cells are page aligned in the file for 4096 byte pages, so on
+ * hosts with larger pages a chunk is mapped from the page it starts in.
+ *
+ * A chunk that cannot be mapped is not fatal, its cells read as walls until a
+ * later read maps it; maze_pager_stats() counts the failures.
+ *
+ * The pager is not thread-safe: even reading a cell may map and unmap chunks.
+ */
+
+// Chunks are (1 << MAZE_CHUNK_SHIFT) bytes, 256x256 cells of a tiled maze
+#define MAZE_CHUNK_SHIFT 16
+#define MAZE_CHUNK_MASK (((size_t)1 << MAZE_CHUNK_SHIFT) - 1)
+
+// Marks the ends of the LRU list
+#define MAZE_CHUNK_NONE UINT32_MAX
+
+struct maze_pager
+{
+  int fd;
+  uint64_t cells_offset; // file offset of the first chunk
+  uint64_t page_mask;    // page size of the host - 1
+
+  uint32_t num_chunks;
+  char** chunks; // mapped address of each chunk, NULL if not resident
+
+  // Resident chunks, from most (mru) to least (lru) recently used
+  uint32_t* prev;
+  uint32_t* next;
+  uint32_t mru;
+  uint32_t lru;
+
+  uint32_t resident;
+  uint32_t max_resident;
+
+  struct maze_pager_stats stats;
+};
+
+struct maze_pager*
+maze_pager_new(int fd, uint64_t cells_offset, size_t cells_size,
+               uint32_t max_resident)
+{
+  struct maze_pager* pager = calloc(1, sizeof(*pager));
+  if (!pager)
+    exit(1);
+
+  pager->fd = fd;
+  pager->cells_offset = cells_offset;
+  pager->page_mask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+  pager->num_chunks = (cells_size + MAZE_CHUNK_MASK) >> MAZE_CHUNK_SHIFT;
+  pager->mru = MAZE_CHUNK_NONE;
+  pager->lru = MAZE_CHUNK_NONE;
+  pager->max_resident = max_resident ? max_resident : 1;
+
+  pager->chunks = calloc(pager->num_chunks, sizeof(*pager->chunks));
+  pager->prev = malloc(pager->num_chunks * sizeof(*pager->prev));
+  pager->next = malloc(pager->num_chunks * sizeof(*pager->next));
+  if (!pager->chunks || !pager->prev || !pager->next)
+    exit(1);
+
+  return pager;
+}
+
+// Returns how far into its mapping (chunk) starts, the mapping starts on the
+// page of the file the chunk starts in
+static size_t
+maze_pager_skip(const struct maze_pager* pager, uint32_t chunk)
+{
+  const uint64_t offset =
+    pager->cells_offset + ((uint64_t)chunk << MAZE_CHUNK_SHIFT);
+  return (size_t)(offset & pager->page_mask);
+}
+
+static void
+maze_pager_unmap(struct maze_pager* pager, uint32_t chunk)
+{
+  const size_t skip = maze_pager_skip(pager, chunk);
+  munmap(pager->chunks[chunk] - skip, skip + MAZE_CHUNK_MASK + 1);
+  pager->chunks[chunk] = NULL;
+}
+
+void
+maze_pager_delete(struct maze_pager** pagerp)
+{
+  struct maze_pager* pager = *pagerp;
+  if (!pager)
+    return;
+
+  for (uint32_t c = pager->mru; c != MAZE_CHUNK_NONE; c = pager->next[c])
+    maze_pager_unmap(pager, c);
+
+  close(pager->fd);
+  free(pager->chunks);
+  free(pager->prev);
+  free(pager->next);
+  free(pager);
+  *pagerp = NULL;
+}
+
+static void
+maze_pager_unlink(struct maze_pager* pager, uint32_t chunk)
+{
+  const uint32_t prev = pager->prev[chunk];
+  const uint32_t next = pager->next[chunk];
+
+  if (prev != MAZE_CHUNK_NONE)
+    pager->next[prev] = next;
+  else
+    pager->mru = next;
+
+  if (next != MAZE_CHUNK_NONE)
+    pager->prev[next] = prev;
+  else
+    pager->lru = prev;
+}
+
+static void
+maze_pager_push_front(struct maze_pager* pager, uint32_t chunk)
+{
+  pager->prev[chunk] = MAZE_CHUNK_NONE;
+  pager->next[chunk] = pager->mru;
+
+  if (pager->mru != MAZE_CHUNK_NONE)
+    pager->prev[pager->mru] = chunk;
+  else
+    pager->lru = chunk;
+
+  pager->mru = chunk;
+}
+
+// Map (chunk) in, evicting the least recently used chunk if we are full
+//
+// Returns 1 on success, 0 if the chunk could not be mapped
+static int
+maze_pager_fault(struct maze_pager* pager, uint32_t chunk)
+{
+  if (pager->resident == pager->max_resident) {
+    const uint32_t victim = pager->lru;
+    maze_pager_unlink(pager, victim);
+    maze_pager_unmap(pager, victim);
+    pager->resident--;
+    pager->stats.evictions++;
+  }
+
+  // The last chunk may be short, the rest of its pages are never read
+  const size_t skip = maze_pager_skip(pager, chunk);
+  const uint64_t offset =
+    pager->cells_offset + ((uint64_t)chunk << MAZE_CHUNK_SHIFT) - skip;
+  char* addr = mmap(NULL, skip + MAZE_CHUNK_MASK + 1, PROT_READ, MAP_SHARED,
+                    pager->fd, (off_t)offset);
+  if (addr == MAP_FAILED) {
+#ifdef DEBUG
+    perror("maze_pager_fault: mmap");
+#endif
+    pager->stats.failures++;
+    return 0;
+  }
+
+  pager->chunks[chunk] = addr + skip;
+  pager->resident++;
+  pager->stats.faults++;
+
+  return 1;
+}
+
+// Returns the cell at position (index) of the maze, see maze_index()
+// Returns '#' if the chunk of the cell cannot be mapped.
+char
+maze_pager_cell(struct maze_pager* pager, size_t index)
+{
+  const uint32_t chunk = (uint32_t)(index >> MAZE_CHUNK_SHIFT);
+
+  if (chunk != pager->mru) {
+    if (pager->chunks[chunk])
+      maze_pager_unlink(pager, chunk);
+    else if (!maze_pager_fault(pager, chunk))
+      return '#';
+
+    maze_pager_push_front(pager, chunk);
+  }
+
+  return pager->chunks[chunk][index & MAZE_CHUNK_MASK];
+}
+
+struct maze_pager_stats
+maze_pager_stats(const struct maze_pager* pager)
+{
+  struct maze_pager_stats stats = pager->stats;
+  stats.resident = pager->resident;
+  return stats;
+}
@@ -0,0 +1,134 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "game.h"
+
+/* Wall distance tables
+ *
+ * maze->rays holds, for every cell and direction, the number of open cells
+ * between the cell and the nearest wall (or edge of the maze) in that
+ * direction, which is what entity_look() returns. The four distances of a
+ * cell are stored next to each other at 4 * maze_index() + direction, so
+ * looking around in every direction reads a single cache line.
+ *
+ * Each distance follows from the one of the neighbouring cell:
+ *   rays(c, dir) = open(step(c, dir)) ? rays(step(c, dir), dir) + 1 : 0
+ * so all of them are filled in two passes over the maze, and a changed cell
+ * only affects the cells in line with it, up to the next wall.
+ */
+
+static bool
+maze_rays_open(const struct maze* maze, struct location loc)
+{
+  return maze_cell(maze, loc.x, loc.y) != '#';
+}
+
+static uint16_t*
+maze_rays_at(const struct maze* maze, struct location loc)
+{
+  return &maze->rays[4 * maze_index(maze, loc.x, loc.y)];
+}
+
+// Compute the distance from (loc) in direction (dir) from its neighbour
+static uint16_t
+maze_rays_follow(const struct maze* maze, struct location loc,
+                 enum direction dir)
+{
+  const struct location next = location_step(loc, dir);
+
+  if (!maze_check_bound_loc(maze, next) || !maze_rays_open(maze, next))
+    return 0;
+
+  return maze_rays_at(maze, next)[dir] + 1;
+}
+
+// Build maze->rays for the current cells and layout of the maze
+// Paged mazes are left without, the tables take eight times the memory of
+// the cells; entity_look() walks the maze when there are no tables.
+void
+maze_build_rays(struct maze* maze)
+{
+  // A shared maze has the rays of the maze it shares, if any
+  if (maze->shared)
+    return;
+
+  if (!maze_mapped(maze, maze->rays))
+    free(maze->rays);
+  maze->rays = NULL;
+
+  if (maze->pager)
+    return;
+
+  maze->rays = malloc(4 * maze_size(maze) * sizeof(*maze->rays));
+  if (!maze->rays)
+    exit(1);
+
+  // North and west come from cells already visited top to bottom, south and
+  // east from cells already visited bottom to top
+  for (uint32_t y = 0; y < maze->maze_height; y++) {
+    for (uint32_t x = 0; x < maze->maze_width; x++) {
+      const struct location loc = {.x = x, .y = y };
+      uint16_t* rays = maze_rays_at(maze, loc);
+      rays[NORTH] = maze_rays_follow(maze, loc, NORTH);
+      rays[WEST] = maze_rays_follow(maze, loc, WEST);
+    }
+  }
+
+  for (uint32_t y = maze->maze_height; y-- > 0;) {
+    for (uint32_t x = maze->maze_width; x-- > 0;) {
+      const struct location loc = {.x = x, .y = y };
+      uint16_t* rays = maze_rays_at(maze, loc);
+      rays[SOUTH] = maze_rays_follow(maze, loc, SOUTH);
+      rays[EAST] = maze_rays_follow(maze, loc, EAST);
+    }
+  }
+}
+
+static enum direction
+maze_rays_reverse(enum direction dir)
+{
+  switch (dir) {
+    case NORTH:
+      return SOUTH;
+    case SOUTH:
+      return NORTH;
+    case EAST:
+      return WEST;
+    case WEST:
+      return EAST;
+  }
+
+  // Not reached
+  return dir;
+}
+
+// Patch maze->rays after the cell at (loc) became or stopped being a wall
+//
+// The cells past (loc) in each direction look back through it. Going away
+// from (loc), each of them is recomputed from the one before, until one is
+// left unchanged or a wall is reached: the cells after that see the same
+// thing as before.
+void
+maze_update_rays(struct maze* maze, struct location loc)
+{
+  if (!maze->rays)
+    return;
+
+  for (enum direction dir = NORTH; dir <= WEST; dir++) {
+    const enum direction back = maze_rays_reverse(dir);
+
+    for (struct location cur = location_step(loc, dir);
+         maze_check_bound_loc(maze, cur); cur = location_step(cur, dir)) {
+      const uint16_t ray = maze_rays_follow(maze, cur, back);
+      uint16_t* rays = maze_rays_at(maze, cur);
+
+      if (rays[back] == ray)
+        break;
+
+      rays[back] = ray;
+      if (!maze_rays_open(maze, cur))
+        break;
+    }
+  }
+}
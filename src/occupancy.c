@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+/* Occupancy counts the entities standing on each cell of a maze
+ *
+ * Mazes of up to OCCUPANCY_GRID_MAX cells get a grid with a counter per cell
+ * id. Larger mazes are usually sparsely populated, a grid would mostly hold
+ * zeros, so they get a hash table of the occupied cells instead: open
+ * addressing with linear probing, keyed by cell id, that holds at most half
+ * as many cells as it has slots. Either way a lookup or update is O(1).
+ *
+ * Games on a shared maze (see game_new_shared()) start with the hash table
+ * too, however small the maze: a server runs thousands of them, each with a
+ * few trolls, and a grid apiece would add up to gigabytes. Their table turns
+ * into a grid once it would take as much memory as one.
+ */
+
+#define OCCUPANCY_GRID_MAX (1u << 22)
+
+// Marks a free slot of the hash table, never a valid cell id
+#define OCCUPANCY_FREE UINT32_MAX
+
+void
+occupancy_init(struct occupancy* occ, const struct maze* maze)
+{
+  const size_t cells = (size_t)maze->maze_width * maze->maze_height;
+
+  *occ = (struct occupancy){.width = maze->maze_width };
+
+  if (cells > OCCUPANCY_GRID_MAX)
+    return;
+
+  if (maze->shared) {
+    occ->grid_cells = (uint32_t)cells;
+    return;
+  }
+
+  occ->grid = calloc(cells, sizeof(*occ->grid));
+  if (!occ->grid)
+    exit(1);
+}
+
+void
+occupancy_destroy(struct occupancy* occ)
+{
+  free(occ->grid);
+  free(occ->keys);
+  free(occ->counts);
+  *occ = (struct occupancy){ 0 };
+}
+
+static uint32_t
+occupancy_hash(const struct occupancy* occ, uint32_t cell)
+{
+  // Fibonacci hashing, (mask) + 1 is a power of two
+  return (uint32_t)((cell * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & occ->mask;
+}
+
+// Returns the slot holding (cell), or the free slot where it would go
+static uint32_t
+occupancy_slot(const struct occupancy* occ, uint32_t cell)
+{
+  uint32_t slot = occupancy_hash(occ, cell);
+  while (occ->keys[slot] != OCCUPANCY_FREE && occ->keys[slot] != cell)
+    slot = (slot + 1) & occ->mask;
+
+  return slot;
+}
+
+static void
+occupancy_rehash(struct occupancy* occ, uint32_t length)
+{
+  const struct occupancy old = *occ;
+
+  occ->mask = length - 1;
+  occ->keys = malloc(length * sizeof(*occ->keys));
+  occ->counts = malloc(length * sizeof(*occ->counts));
+  if (!occ->keys || !occ->counts)
+    exit(1);
+
+  memset(occ->keys, 0xff, length * sizeof(*occ->keys));
+
+  for (uint32_t i = 0; old.keys && i <= old.mask; i++) {
+    if (old.keys[i] == OCCUPANCY_FREE)
+      continue;
+
+    const uint32_t slot = occupancy_slot(occ, old.keys[i]);
+    occ->keys[slot] = old.keys[i];
+    occ->counts[slot] = old.counts[i];
+  }
+
+  free(old.keys);
+  free(old.counts);
+}
+
+// Move the counts from the hash table into a grid
+static void
+occupancy_to_grid(struct occupancy* occ)
+{
+  occ->grid = calloc(occ->grid_cells, sizeof(*occ->grid));
+  if (!occ->grid)
+    exit(1);
+
+  for (uint32_t i = 0; occ->keys && i <= occ->mask; i++)
+    if (occ->keys[i] != OCCUPANCY_FREE)
+      occ->grid[occ->keys[i]] = occ->counts[i];
+
+  free(occ->keys);
+  free(occ->counts);
+  occ->keys = occ->counts = NULL;
+  occ->mask = occ->used = 0;
+}
+
+// Empty the slot (hole) and move back the entries after it that would no
+// longer be found past the hole
+static void
+occupancy_erase(struct occupancy* occ, uint32_t hole)
+{
+  for (uint32_t slot = (hole + 1) & occ->mask;
+       occ->keys[slot] != OCCUPANCY_FREE; slot = (slot + 1) & occ->mask) {
+    const uint32_t home = occupancy_hash(occ, occ->keys[slot]);
+
+    // The entry can fill the hole if its home is not in (hole, slot]
+    if (((slot - home) & occ->mask) >= ((slot - hole) & occ->mask)) {
+      occ->keys[hole] = occ->keys[slot];
+      occ->counts[hole] = occ->counts[slot];
+      hole = slot;
+    }
+  }
+
+  occ->keys[hole] = OCCUPANCY_FREE;
+  occ->used--;
+}
+
+uint32_t
+occupancy_count(const struct occupancy* occ, struct location loc)
+{
+  const uint32_t cell = occ->width * loc.y + loc.x;
+
+  if (occ->grid)
+    return occ->grid[cell];
+
+  if (!occ->keys)
+    return 0;
+
+  const uint32_t slot = occupancy_slot(occ, cell);
+  return occ->keys[slot] == cell ? occ->counts[slot] : 0;
+}
+
+void
+occupancy_add(struct occupancy* occ, struct location loc)
+{
+  const uint32_t cell = occ->width * loc.y + loc.x;
+
+  if (occ->grid) {
+    occ->grid[cell]++;
+    return;
+  }
+
+  if (!occ->keys || 2 * (occ->used + 1) > occ->mask + 1) {
+    const uint32_t length = occ->keys ? 2 * (occ->mask + 1) : 64;
+
+    // A slot holds a key and a count, a grid a count per cell
+    if (occ->grid_cells && 2 * (uint64_t)length >= occ->grid_cells) {
+      occupancy_to_grid(occ);
+      occ->grid[cell]++;
+      return;
+    }
+    occupancy_rehash(occ, length);
+  }
+
+  const uint32_t slot = occupancy_slot(occ, cell);
+  if (occ->keys[slot] == cell) {
+    occ->counts[slot]++;
+  } else {
+    occ->keys[slot] = cell;
+    occ->counts[slot] = 1;
+    occ->used++;
+  }
+}
+
+void
+occupancy_remove(struct occupancy* occ, struct location loc)
+{
+  const uint32_t cell = occ->width * loc.y + loc.x;
+
+  if (occ->grid) {
+    occ->grid[cell]--;
+    return;
+  }
+
+  if (!occ->keys)
+    return;
+
+  const uint32_t slot = occupancy_slot(occ, cell);
+  if (occ->keys[slot] == cell && --occ->counts[slot] == 0)
+    occupancy_erase(occ, slot);
+}
+
+void
+occupancy_move(struct occupancy* occ, struct location from,
+               struct location to)
+{
+  occupancy_remove(occ, from);
+  occupancy_add(occ, to);
+}
@@ -1,421 +1,395 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "path.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* pathloc is used by Dijkstra's algorithm below,
- * it hold the location as an (x, y) coord pair,
- * The iterative distance to that node (initally infinity)
- * And a link to that node's parent
+/* path_heap is the priority queue of cells still to be expanded by Dijkstra's
+ * algorithm below, a binary heap on the distance of each cell from the source
+ * that doubles in size when it fills up.
  */
-struct pathloc
+struct path_node
 {
-  struct location loc;
-  int32_t distance;
-  bool visited;
-  bool in_queue;
-  struct pathloc* parent; // links for the path
+  uint32_t distance;
+  uint32_t cell;
 };
 
-struct bheap
+struct path_heap
 {
-  size_t last_node;
+  size_t count;
   size_t length;
-  struct pathloc** nodes;
+  struct path_node* nodes;
 };
 
-struct bheap* bheap_new(void);
-void bheap_delete(struct bheap**);
-void bheap_insert(struct bheap*, struct pathloc*);
-struct pathloc* bheap_peek(struct bheap*);
-struct pathloc* bheap_pop(struct bheap*);
+/* path_marks records, for every cell reached by the search, 1 + the direction
+ * we moved in to reach it (0 if the cell has not been reached).
+ * It is split into blocks that are only allocated once the search gets to
+ * them, so searching a small part of a huge (paged) maze only costs memory for
+ * that part. (touched) lists the blocks the current search has written to.
+ */
+struct path_marks
+{
+  size_t num_blocks;
+  unsigned char** blocks;
 
-void bheap_bubble_down(struct bheap*, size_t);
-void bheap_bubble_up(struct bheap*);
-void bheap_update(struct bheap*, struct pathloc*);
+  bool* dirty;      // whether each block was written to
+  size_t* touched;  // the dirty blocks, in the order they were written to
+  size_t num_touched;
+  size_t num_kept; // blocks allocated
+};
 
-///
-///
-///
+#define PATH_BLOCK_SHIFT 16
+#define PATH_BLOCK_MASK (((size_t)1 << PATH_BLOCK_SHIFT) - 1)
 
-struct bheap*
-bheap_new(void)
+// Blocks a thread keeps between searches, 4 MiB of marks
+#define PATH_KEEP_BLOCKS 64
+
+/* The marks and the heap of a thread are kept from one search to the next,
+ * so a search allocates nothing once they have grown to the size of the
+ * maze. Each thread has its own, searches run in parallel (see
+ * trolls_update_all()).
+ */
+struct path_scratch
 {
-  struct bheap* bheap = calloc(1, sizeof(*bheap));
-  if (!bheap)
-    exit(1);
+  struct path_marks marks;
+  struct path_heap heap;
+};
 
-  bheap->last_node = 1;
-  bheap->length = 512;
-  bheap->nodes = calloc(bheap->length, sizeof(*bheap->nodes));
-  if (!bheap->nodes)
-    exit(1);
+static pthread_key_t path_scratch_key;
+static pthread_once_t path_scratch_once = PTHREAD_ONCE_INIT;
 
-  return bheap;
-}
+// The mark of the source cell
+#define PATH_SOURCE 0xff
 
-void
-bheap_delete(struct bheap** bheapp)
+static unsigned char
+path_marks_get(const struct path_marks* marks, size_t index)
 {
-  struct bheap* bheap = *bheapp;
-  free(bheap->nodes);
-  free(bheap);
-  *bheapp = NULL;
+  const unsigned char* block = marks->blocks[index >> PATH_BLOCK_SHIFT];
+  return block ? block[index & PATH_BLOCK_MASK] : 0;
 }
 
-void
-bheap_bubble_up(struct bheap* bheap)
+static void
+path_marks_set(struct path_marks* marks, size_t index, unsigned char mark)
 {
-  size_t my_idx, parent_idx;
-  struct pathloc *parent, *me;
+  unsigned char** block = &marks->blocks[index >> PATH_BLOCK_SHIFT];
 
-  my_idx = bheap->last_node - 1;
-
-  while (my_idx > 1) {
-    parent_idx = my_idx / 2;
-    parent = bheap->nodes[parent_idx];
-    me = bheap->nodes[my_idx];
-
-    if (parent->distance <= me->distance)
-      break;
+  if (!*block) {
+    *block = calloc(PATH_BLOCK_MASK + 1, sizeof(**block));
+    if (!*block)
+      exit(1);
 
-    bheap->nodes[parent_idx] = me;
-    bheap->nodes[my_idx] = parent;
+    pool_count_system(POOL_SCRATCH);
+    marks->num_kept++;
+  }
 
-    my_idx /= 2;
+  if (!marks->dirty[index >> PATH_BLOCK_SHIFT]) {
+    marks->dirty[index >> PATH_BLOCK_SHIFT] = true;
+    marks->touched[marks->num_touched++] = index >> PATH_BLOCK_SHIFT;
   }
+
+  (*block)[index & PATH_BLOCK_MASK] = mark;
 }
 
-void
-bheap_bubble_down(struct bheap* bheap, size_t node_idx)
+// Make room for the marks of a maze of (size) cells
+static void
+path_marks_reserve(struct path_marks* marks, size_t size)
 {
-  struct pathloc *root, *child1, *child2, *tmp;
-
-  while ((node_idx * 2 + 1) < bheap->last_node) {
-    root = bheap->nodes[node_idx];
-    child1 = bheap->nodes[node_idx * 2];
-    child2 = bheap->nodes[node_idx * 2 + 1];
+  const size_t num_blocks = (size + PATH_BLOCK_MASK) >> PATH_BLOCK_SHIFT;
+  if (num_blocks <= marks->num_blocks)
+    return;
 
-    if (child1 == NULL)
-      break;
+  unsigned char** blocks =
+    realloc(marks->blocks, num_blocks * sizeof(*blocks));
+  bool* dirty = realloc(marks->dirty, num_blocks * sizeof(*dirty));
+  size_t* touched = realloc(marks->touched, num_blocks * sizeof(*touched));
+  if (!blocks || !dirty || !touched)
+    exit(1);
 
-    if (child2 == NULL) {
-      if (root->distance <= child1->distance)
-        break;
-      bheap->nodes[node_idx] = child1;
-      bheap->nodes[node_idx * 2 + 1] = root;
-      break;
-    }
+  pool_count_system(POOL_SCRATCH);
 
-    if (root->distance <= child1->distance &&
-        root->distance <= child2->distance)
-      break;
+  for (size_t i = marks->num_blocks; i < num_blocks; i++) {
+    blocks[i] = NULL;
+    dirty[i] = false;
+  }
 
-    size_t new_node_idx;
+  marks->blocks = blocks;
+  marks->dirty = dirty;
+  marks->touched = touched;
+  marks->num_blocks = num_blocks;
+}
 
-    tmp = child1;
-    new_node_idx = node_idx * 2;
-    if (child1->distance > child2->distance) {
-      tmp = child2;
-      new_node_idx = node_idx * 2 + 1;
+// Clear the marks of the last search
+// The blocks are kept for the next one, up to PATH_KEEP_BLOCKS of them; a
+// search over a huge maze should not hold on to its memory.
+static void
+path_marks_clear(struct path_marks* marks)
+{
+  for (size_t i = 0; i < marks->num_touched; i++) {
+    const size_t b = marks->touched[i];
+
+    if (marks->num_kept > PATH_KEEP_BLOCKS) {
+      free(marks->blocks[b]);
+      marks->blocks[b] = NULL;
+      marks->num_kept--;
+    } else {
+      memset(marks->blocks[b], 0, PATH_BLOCK_MASK + 1);
     }
+    marks->dirty[b] = false;
+  }
 
-    bheap->nodes[node_idx] = tmp;
-    bheap->nodes[new_node_idx] = root;
+  marks->num_touched = 0;
+}
 
-    node_idx = new_node_idx;
-  }
+static void
+path_scratch_free(void* ptr)
+{
+  struct path_scratch* scratch = ptr;
+
+  for (size_t i = 0; i < scratch->marks.num_blocks; i++)
+    free(scratch->marks.blocks[i]);
+  free(scratch->marks.blocks);
+  free(scratch->marks.dirty);
+  free(scratch->marks.touched);
+  free(scratch->heap.nodes);
+  free(scratch);
 }
 
-void
-bheap_insert(struct bheap* bheap, struct pathloc* node)
+static void
+path_scratch_init(void)
 {
-  if (bheap->last_node >= bheap->length - 1) {
-    struct pathloc** new_nodes =
-      realloc(bheap->nodes, sizeof(*bheap->nodes) * bheap->length * 2);
-    if (!new_nodes)
-      return;
-    bheap->length *= 2;
-    bheap->nodes = new_nodes;
-  }
+  if (pthread_key_create(&path_scratch_key, path_scratch_free))
+    exit(1);
+}
+
+// Returns the scratch space of the calling thread, freed when it exits
+static struct path_scratch*
+path_scratch_get(void)
+{
+  pthread_once(&path_scratch_once, path_scratch_init);
 
-  bheap->nodes[bheap->last_node] = node;
+  struct path_scratch* scratch = pthread_getspecific(path_scratch_key);
+  if (!scratch) {
+    scratch = calloc(1, sizeof(*scratch));
+    if (!scratch || pthread_setspecific(path_scratch_key, scratch))
+      exit(1);
 
-  if (bheap->last_node == 1) {
-    bheap->last_node++;
-    return;
+    pool_count_system(POOL_SCRATCH);
   }
 
-  bheap->last_node++;
-  bheap_bubble_up(bheap);
+  return scratch;
 }
 
-struct pathloc*
-bheap_peek(struct bheap* bheap)
+static void
+path_heap_insert(struct path_heap* heap, struct path_node node)
 {
-  if (bheap->last_node < 2)
-    return NULL;
-  return bheap->nodes[1];
+  if (heap->count == heap->length) {
+    const size_t length = heap->length ? heap->length * 2 : 256;
+    struct path_node* nodes = realloc(heap->nodes, length * sizeof(*nodes));
+    if (!nodes)
+      exit(1);
+
+    pool_count_system(POOL_SCRATCH);
+    heap->length = length;
+    heap->nodes = nodes;
+  }
+
+  // Bubble up from the last node
+  size_t idx = heap->count++;
+  while (idx > 0) {
+    const size_t parent = (idx - 1) / 2;
+    if (heap->nodes[parent].distance <= node.distance)
+      break;
+
+    heap->nodes[idx] = heap->nodes[parent];
+    idx = parent;
+  }
+
+  heap->nodes[idx] = node;
 }
 
-struct pathloc*
-bheap_pop(struct bheap* bheap)
+static struct path_node
+path_heap_pop(struct path_heap* heap)
 {
-  if (bheap->last_node < 2)
-    return NULL;
+  const struct path_node min = heap->nodes[0];
+  const struct path_node last = heap->nodes[--heap->count];
+
+  // Bubble the last node down from the root
+  size_t idx = 0;
+  for (;;) {
+    size_t child = 2 * idx + 1;
+    if (child >= heap->count)
+      break;
+    if (child + 1 < heap->count &&
+        heap->nodes[child + 1].distance < heap->nodes[child].distance)
+      child++;
+    if (last.distance <= heap->nodes[child].distance)
+      break;
 
-  struct pathloc* min = bheap->nodes[1];
+    heap->nodes[idx] = heap->nodes[child];
+    idx = child;
+  }
 
-  bheap->last_node--;
+  if (heap->count)
+    heap->nodes[idx] = last;
 
-  if (bheap->last_node > 1) {
-    bheap->nodes[1] = bheap->nodes[bheap->last_node];
-    bheap->nodes[bheap->last_node] = NULL;
+  return min;
+}
 
-    bheap_bubble_down(bheap, 1);
+static enum direction
+path_reverse(enum direction dir)
+{
+  switch (dir) {
+    case NORTH:
+      return SOUTH;
+    case SOUTH:
+      return NORTH;
+    case EAST:
+      return WEST;
+    case WEST:
+      return EAST;
   }
 
-  return min;
+  // Not reached
+  return dir;
 }
 
-void
-bheap_update(struct bheap* bheap, struct pathloc* node)
+// Follow the marks back from (dest) to the source and build the path
+// The path stops one step short of (dest), the last step is left out.
+static struct path*
+path_trace(const struct maze* maze, const struct path_marks* from,
+           struct location dest)
 {
-  size_t my_idx = 0;
+  // Count the steps back to the source, then walk back again to fill them in
+  struct location loc = dest;
+  size_t num_steps = 0;
+  unsigned char dir;
+  while ((dir = path_marks_get(from, maze_index(maze, loc.x, loc.y))) !=
+         PATH_SOURCE) {
+    loc = location_step(loc, path_reverse(dir - 1));
+    num_steps++;
+  }
 
-  for (size_t i = 1; i < bheap->last_node; i++) {
-    if (bheap->nodes[i] == node)
-      my_idx = i;
+  struct path* ret_path = path_new(num_steps ? num_steps - 1 : 0);
+
+  loc = dest;
+  for (size_t i = num_steps; i > 0; i--) {
+    dir = path_marks_get(from, maze_index(maze, loc.x, loc.y));
+    if (i - 1 < ret_path->num_steps)
+      ret_path->steps[i - 1] = dir - 1;
+    loc = location_step(loc, path_reverse(dir - 1));
   }
 
-  if (my_idx == 0)
-    return;
+#ifdef PATH_TRACE
+  fprintf(stderr, "%zu steps to destination\n", ret_path->num_steps);
+#endif
 
-  bheap_bubble_down(bheap, my_idx);
+  return ret_path;
 }
 
-///
-///
-
 // Return an array of steps to get from source location (s) to target location
 // (t). The length of the array is returned in the passes size_t pointer (l).
 //
 // Calculate the shortest route to the destination (dest)
 //
-// Returns non-zero on all of the following: &&
-//  - a path structure was found for this troll
-//  - the destination is valid and within range
+// Returns non-NULL on all of the following: &&
+//  - the destination is an empty space within range
 //  - an actual path was found to reach the destination
 //
-// Returns zero on any of the following: ||
-//  - no path structure has been allocated for this troll
+// Returns NULL on any of the following: ||
 //  - destination is invalid
 //  - we cannot calculate a path to the destination
 //
 ////////////////////
 ////////////////////
 //
-// - Mark each node with a distance of infinity(-1) and being unvisited
-// - Each node has an undefined parent node
-// - Check if the node is a traversible space - drop it if we can't move there
-// - Add all unvisited nodes to a queue
+// - Mark each cell as not reached, except the source at a distance of 0
+// - Add the source to the queue
 //
 // While queue is not empty:
-//  cur = find a node with the smallest distance
+//  cur = pop the cell with the smallest distance
 //
 //  if cur == target
 //   terminate while loop
 //
-//  foreach adjacent node(a) to cur(c):
-//   new_dist = distance of c + distance between c and a
-//   if new_dist < distance of a
-//    distance of a = new_dist
-//    parent of a = c
+//  foreach empty adjacent cell(a) of cur that has not been reached yet:
+//   remember the direction taken from cur to reach a
+//   add a to the queue at the distance of cur + 1
 //
-//  remove cur from queue
+// Every move costs the same and cells leave the queue in order of distance,
+// so the first time a cell is reached is along a shortest path to it: there
+// is no distance to update later on, and only the direction is kept.
 //
-// Start with target node, and follow the prev(parent) links up to the
-// current node. This is the reverse direction we need to travel to reach the
-// target node.
+// Start with the target cell and follow the remembered directions backwards
+// up to the source. This gives the steps in reverse, so they are written from
+// the end of the steps array to its start. The path stops next to the target.
 //
-// Push each node onto a stack as we're following their parent.
-// Pop each node from the stack and calculate the direction we need to travel
-//  to get there.
-// Then append the direction to the steps array (up to MAX_STEPS moves).
-
-// FIXME
-// Don't implement the stack here
+// The marks are indexed with maze_index(), so they are laid out the same way as
+// the maze cells themselves.
 struct path*
 path_find(const struct maze* maze, struct location source, struct location dest)
 {
-  struct path* ret_path = calloc(1, sizeof(*ret_path));
-  if (!ret_path)
-    exit(1);
-
-  // target is the pathloc of the target vertex
-  struct pathloc* target = NULL;
-
-  struct bheap* bheap;
-  bheap = bheap_new();
-
-  // Each vertex is added into an array
-  size_t storage_idx = 0;
-  struct pathloc** storage;
-  storage = calloc(maze->maze_width * maze->maze_height, sizeof(*storage));
-
-  // first vertex is the source
-  {
-    struct pathloc* initial = calloc(1, sizeof(*initial));
-    if (!initial)
-      exit(1);
-    initial->loc = source;
-    initial->distance = 0; // Distance to self is 0
-    initial->in_queue = true;
-    bheap_insert(bheap, initial);
-    storage[storage_idx++] = initial;
-
-#ifdef DEBUG
-    fprintf(stderr, "Added Source\n");
-#endif
-  }
+  if (!maze_check_bound_loc(maze, source) ||
+      !maze_is_empty_space_loc(maze, dest))
+    return NULL;
 
-  /* Find each valid space and add it to the storage array */
-  for (uint16_t y = 0; y < maze->maze_height; y++) {
-    for (uint16_t x = 0; x < maze->maze_width; x++) {
+  // Cells in different regions of the maze can never be connected
+  if (maze->components && maze->components[maze_cell_id(maze, source)] !=
+                            maze->components[maze_cell_id(maze, dest)])
+    return NULL;
 
-      struct location loc = (struct location){.x = x, .y = y };
+  struct path_scratch* scratch = path_scratch_get();
+  struct path_marks* from = &scratch->marks;
+  struct path_heap* heap = &scratch->heap;
 
-      if (!maze_is_empty_space_loc(maze, loc) ||
-          // ignore the source location since we added that one above
-          (loc.x == source.x && loc.y == source.y))
-        continue;
+  path_marks_reserve(from, maze_size(maze));
+  heap->count = 0;
 
-      struct pathloc* ploc = calloc(1, sizeof(*ploc));
-      if (!ploc)
-        exit(1);
+  const uint32_t target = maze_cell_id(maze, dest);
+  bool found = false;
 
-      ploc->loc = loc;
-      ploc->distance = 0x10000; // some large number
-      storage[storage_idx++] = ploc;
-    }
-  }
-#ifdef DEBUG
-  fprintf(stderr, "Added Others\n");
-#endif
+  path_marks_set(from, maze_index(maze, source.x, source.y), PATH_SOURCE);
+  const struct path_node start = {.cell = maze_cell_id(maze, source) };
+  path_heap_insert(heap, start);
 
-  // Calculate the distance from the source to each node
   // This is the "main loop" of the pathfinder
-  while (bheap_peek(bheap)) {
-    struct pathloc* min = bheap_pop(bheap);
-    min->visited = true;
-
-#ifdef DEBUG
-    fprintf(stderr, "Found minimum: %d\n", min->distance);
-#endif
+  while (heap->count) {
+    const struct path_node min = path_heap_pop(heap);
 
     // Break when we find the target
-    if (min->loc.x == dest.x && min->loc.y == dest.y) {
-#ifdef DEBUG
-      fprintf(stderr, "Found target\n");
-#endif
-      target = min;
+    if (min.cell == target) {
+      found = true;
       break;
     }
 
-    struct pathloc* adj;
+    const struct location cur = maze_cell_loc(maze, min.cell);
+    for (enum direction dir = NORTH; dir <= WEST; dir++) {
+      const struct location adj = location_step(cur, dir);
 
-    // Find an adjacent space in our storage array
-    for (uint16_t i = 0; i < storage_idx; i++) {
-      adj = storage[i];
-
-      if (adj->visited) {
-#ifdef DEBUG
-        fprintf(stderr, "Node already visited %d/%lu\n", i, storage_idx - 1);
-#endif
+      if (!maze_is_empty_space_loc(maze, adj))
         continue;
-      }
 
-      if (!location_adjacent(min->loc, adj->loc)) {
-#ifdef DEBUG
-        fprintf(stderr, "Node not adjacent %d/%lu\n", i, storage_idx - 1);
-#endif
+      const size_t adj_index = maze_index(maze, adj.x, adj.y);
+      if (path_marks_get(from, adj_index))
         continue;
-      }
 
-#ifdef DEBUG
-      fprintf(stderr, "(%d, %d) found neighbor (%d, %d)\n", min->loc.x,
-              min->loc.y, adj->loc.x, adj->loc.y);
-#endif
-
-      if (adj->distance > min->distance + 1) {
-        if (adj->in_queue == false) {
-          bheap_insert(bheap, adj);
-          adj->in_queue = true;
-        }
-        adj->distance = min->distance + 1;
-        adj->parent = min;
-
-        bheap_update(bheap, adj);
-#ifdef DEBUG
-        fprintf(stderr, "Updated Neighbor: %d\n", adj->distance);
-#endif
-      }
+      path_marks_set(from, adj_index, (unsigned char)(dir + 1));
+      path_heap_insert(heap,
+                       (struct path_node){.distance = min.distance + 1,
+                                          .cell = maze_cell_id(maze, adj) });
     }
   }
 
-  // Find the path.
-  // We're essentially back tracing thru the path.
-  // So we use a stack to reverse the direction
-  // The last move required to get us to the target goes down first, to the
-  // bottom of the stack.
-  if (target) {
-    ret_path->next = 0;
-    ret_path->num_steps = maze->maze_width * maze->maze_height;
-    ret_path->steps = calloc(ret_path->num_steps, sizeof(*ret_path->steps));
+  struct path* ret_path = found ? path_trace(maze, from, dest) : NULL;
 
-    enum direction* stack;
-    stack = calloc(maze->maze_width * maze->maze_height, sizeof(*stack));
-    size_t stack_top = 0;
-
-    while (target && target->parent) {
-
-      enum direction rel_dir = NORTH;
-      location_relative(target->parent->loc, target->loc, &rel_dir);
-      stack[stack_top++] = rel_dir;
-
-      target = target->parent;
-    }
-
-    ret_path->num_steps = stack_top - 1;
-#ifdef DEBUG
-    fprintf(stderr, "%lu steps to destination\n", ret_path->num_steps);
-#endif
-
-    while (ret_path->next < ret_path->num_steps && stack_top > 0)
-      ret_path->steps[ret_path->next++] = stack[--stack_top];
-    free(stack);
-
-    ret_path->next = 0;
-  } else {
-#ifdef DEBUG
+#ifdef PATH_TRACE
+  if (!ret_path)
     fprintf(stderr, "Could not find path (%d, %d) -> (%d, %d)\n", source.x,
             source.y, dest.x, dest.y);
 #endif
-    free(ret_path);
-    ret_path = NULL;
-  }
-
-  // Cleanup the allocated memory for the heap
-  while (bheap_peek(bheap))
-    bheap_pop(bheap);
-  bheap_delete(&bheap);
 
-  // Cleanup the storage
-  for (uint16_t i = 0; i < storage_idx; i++)
-    free(storage[i]);
-  free(storage);
+  path_marks_clear(from);
 
-#ifdef DEBUG
-  fprintf(stderr, "\n\n");
-#endif
   return ret_path;
 }
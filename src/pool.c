@@ -0,0 +1,308 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+#include "path.h"
+
+/* Allocators for what the game creates and throws away as it runs
+ *
+ * Entities and paths come from fixed-size pools: slabs of POOL_SLAB objects
+ * carved up into a free list. Objects given back go on the free list and are
+ * handed out again, slabs are never returned to the system.
+ *
+ * Step buffers come in size classes of 16, 32, 64... steps, each with a free
+ * list of buffers given back. A path takes a buffer of the smallest class
+ * that fits it, and the buffer goes back on that class's list when the path
+ * is deleted. Paths longer than the largest class are rare enough to come
+ * from malloc() directly.
+ *
+ * Once a single-threaded game has run for a while every list holds enough to
+ * go around, and a tick does not allocate at all; pool_stats() counts what is
+ * taken from the system to check that. With paths planned on a job_pool it
+ * still does now and then: step buffers are taken on the planning threads and
+ * given back on the thread that commits the tick, so they keep leaving the
+ * caches of the one for those of the other, and some are allocated anew.
+ *
+ * The lists are shared by all threads, paths are found on the threads of a
+ * job_pool and on every shard of a server. Each thread keeps a cache of up to
+ * 2 * POOL_CACHE_BATCH free objects per list in front of them, and only takes
+ * the lock of a list to move POOL_CACHE_BATCH objects at once, between its
+ * cache and the list. What is in the cache of a thread when it ends stays
+ * there: slabs are never returned anyway, and that is a bounded amount.
+ */
+
+// Objects per slab of a fixed-size pool
+#define POOL_SLAB 256
+
+// Objects moved at once between a shared list and the cache of a thread
+#define POOL_CACHE_BATCH 32
+
+// Steps in the smallest and largest size class of step buffers
+#define POOL_STEPS_MIN_SHIFT 4
+#define POOL_STEPS_CLASSES 13 // up to 65536 steps
+
+// A free object, the first bytes of it link to the next one
+struct pool_free
+{
+  struct pool_free* next;
+};
+
+struct pool_list
+{
+  pthread_mutex_t lock;
+  struct pool_free* free;
+};
+
+// The free objects of one list a thread keeps to itself
+struct pool_cache
+{
+  struct pool_free* free;
+  uint32_t count;
+};
+
+struct pool_counters
+{
+  atomic_uint_fast64_t allocs;
+  atomic_uint_fast64_t frees;
+  atomic_uint_fast64_t system;
+};
+
+static struct pool_list pool_objects[] = {
+  [POOL_ENTITY] = {.lock = PTHREAD_MUTEX_INITIALIZER },
+  [POOL_PATH] = {.lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+static const size_t pool_object_size[] = {
+  [POOL_ENTITY] = sizeof(struct entity),
+  [POOL_PATH] = sizeof(struct path),
+};
+
+static struct pool_list pool_steps[POOL_STEPS_CLASSES] = {
+  {.lock = PTHREAD_MUTEX_INITIALIZER }, {.lock = PTHREAD_MUTEX_INITIALIZER },
+  {.lock = PTHREAD_MUTEX_INITIALIZER }, {.lock = PTHREAD_MUTEX_INITIALIZER },
+  {.lock = PTHREAD_MUTEX_INITIALIZER }, {.lock = PTHREAD_MUTEX_INITIALIZER },
+  {.lock = PTHREAD_MUTEX_INITIALIZER }, {.lock = PTHREAD_MUTEX_INITIALIZER },
+  {.lock = PTHREAD_MUTEX_INITIALIZER }, {.lock = PTHREAD_MUTEX_INITIALIZER },
+  {.lock = PTHREAD_MUTEX_INITIALIZER }, {.lock = PTHREAD_MUTEX_INITIALIZER },
+  {.lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+static _Thread_local struct pool_cache pool_object_caches[POOL_KINDS];
+static _Thread_local struct pool_cache pool_steps_caches[POOL_STEPS_CLASSES];
+
+static struct pool_counters pool_counters[POOL_KINDS];
+
+// Returns the size of the objects of the fixed-size pool (kind), rounded up
+// so that every object of a slab stays aligned
+static size_t
+pool_stride(enum pool_kind kind)
+{
+  const size_t align = sizeof(max_align_t);
+  size_t size = pool_object_size[kind];
+
+  if (size < sizeof(struct pool_free))
+    size = sizeof(struct pool_free);
+
+  return (size + align - 1) / align * align;
+}
+
+// Take an object off (cache), refilled from (list) when it is empty
+// Returns NULL if both are empty.
+static void*
+pool_list_pop(struct pool_list* list, struct pool_cache* cache)
+{
+  if (!cache->free) {
+    pthread_mutex_lock(&list->lock);
+    while (list->free && cache->count < POOL_CACHE_BATCH) {
+      struct pool_free* object = list->free;
+      list->free = object->next;
+      object->next = cache->free;
+      cache->free = object;
+      cache->count++;
+    }
+    pthread_mutex_unlock(&list->lock);
+
+    if (!cache->free)
+      return NULL;
+  }
+
+  struct pool_free* object = cache->free;
+  cache->free = object->next;
+  cache->count--;
+
+  return object;
+}
+
+// Put (ptr) on (cache), and a batch of the cache back on (list) once it holds
+// more than the thread is likely to need
+static void
+pool_list_push(struct pool_list* list, struct pool_cache* cache, void* ptr)
+{
+  struct pool_free* object = ptr;
+  object->next = cache->free;
+  cache->free = object;
+  if (++cache->count < 2 * POOL_CACHE_BATCH)
+    return;
+
+  struct pool_free* first = cache->free;
+  struct pool_free* last = first;
+  for (uint32_t i = 1; i < POOL_CACHE_BATCH; i++)
+    last = last->next;
+  cache->free = last->next;
+  cache->count -= POOL_CACHE_BATCH;
+
+  pthread_mutex_lock(&list->lock);
+  last->next = list->free;
+  list->free = first;
+  pthread_mutex_unlock(&list->lock);
+}
+
+// Carve a new slab for the pool (kind), returns one of its objects and puts
+// the others on the free list
+static void*
+pool_grow(enum pool_kind kind)
+{
+  const size_t stride = pool_stride(kind);
+  char* slab = malloc(POOL_SLAB * stride);
+  if (!slab)
+    exit(1);
+
+  atomic_fetch_add(&pool_counters[kind].system, 1);
+
+  struct pool_list* list = &pool_objects[kind];
+  pthread_mutex_lock(&list->lock);
+  for (size_t i = POOL_SLAB - 1; i > 0; i--) {
+    struct pool_free* object = (struct pool_free*)(void*)(slab + i * stride);
+    object->next = list->free;
+    list->free = object;
+  }
+  pthread_mutex_unlock(&list->lock);
+
+  return slab;
+}
+
+// Returns a zeroed object from the fixed-size pool (kind), one of POOL_ENTITY
+// or POOL_PATH
+void*
+pool_get(enum pool_kind kind)
+{
+  void* object = pool_list_pop(&pool_objects[kind], &pool_object_caches[kind]);
+  if (!object)
+    object = pool_grow(kind);
+
+  atomic_fetch_add(&pool_counters[kind].allocs, 1);
+
+  memset(object, 0, pool_object_size[kind]);
+  return object;
+}
+
+// Give (object), from pool_get(kind), back to its pool
+void
+pool_put(enum pool_kind kind, void* object)
+{
+  if (!object)
+    return;
+
+  atomic_fetch_add(&pool_counters[kind].frees, 1);
+  pool_list_push(&pool_objects[kind], &pool_object_caches[kind], object);
+}
+
+// Returns the size class of a buffer of (num_steps) steps
+// POOL_STEPS_CLASSES for buffers larger than the largest class
+static unsigned
+pool_steps_class(size_t num_steps)
+{
+  unsigned size_class = 0;
+  while (size_class < POOL_STEPS_CLASSES &&
+         ((size_t)1 << (size_class + POOL_STEPS_MIN_SHIFT)) < num_steps)
+    size_class++;
+
+  return size_class;
+}
+
+// Returns a buffer for (num_steps) steps, NULL for none
+enum direction*
+pool_get_steps(size_t num_steps)
+{
+  if (!num_steps)
+    return NULL;
+
+  const unsigned size_class = pool_steps_class(num_steps);
+  enum direction* steps = NULL;
+
+  if (size_class < POOL_STEPS_CLASSES) {
+    steps =
+      pool_list_pop(&pool_steps[size_class], &pool_steps_caches[size_class]);
+    num_steps = (size_t)1 << (size_class + POOL_STEPS_MIN_SHIFT);
+  }
+
+  if (!steps) {
+    steps = malloc(num_steps * sizeof(*steps));
+    if (!steps)
+      exit(1);
+
+    atomic_fetch_add(&pool_counters[POOL_STEPS].system, 1);
+  }
+
+  atomic_fetch_add(&pool_counters[POOL_STEPS].allocs, 1);
+  return steps;
+}
+
+// Give back (steps), from pool_get_steps() for (num_steps) steps or more
+void
+pool_put_steps(enum direction* steps, size_t num_steps)
+{
+  if (!steps)
+    return;
+
+  atomic_fetch_add(&pool_counters[POOL_STEPS].frees, 1);
+
+  const unsigned size_class = pool_steps_class(num_steps);
+  if (size_class < POOL_STEPS_CLASSES)
+    pool_list_push(&pool_steps[size_class], &pool_steps_caches[size_class],
+                   steps);
+  else
+    free(steps);
+}
+
+struct path*
+path_new(size_t num_steps)
+{
+  struct path* path = pool_get(POOL_PATH);
+  path->num_steps = num_steps;
+  path->steps = pool_get_steps(num_steps);
+
+  return path;
+}
+
+void
+path_delete(struct path* path)
+{
+  if (!path)
+    return;
+
+  pool_put_steps(path->steps, path->num_steps);
+  pool_put(POOL_PATH, path);
+}
+
+void
+pool_count_system(enum pool_kind kind)
+{
+  atomic_fetch_add(&pool_counters[kind].system, 1);
+}
+
+struct pool_stats
+pool_stats(enum pool_kind kind)
+{
+  return (struct pool_stats){
+    .allocs = atomic_load(&pool_counters[kind].allocs),
+    .frees = atomic_load(&pool_counters[kind].frees),
+    .system = atomic_load(&pool_counters[kind].system),
+  };
+}
@@ -0,0 +1,228 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+/* Input recordings
+ *
+ * A game is fully determined by its maze, the seed of its random numbers, the
+ * number of trolls, how their path searches are scheduled and the key pressed
+ * on every tick (see game_tick()), so that is all a recording holds:
+ *
+ *   magic        uint32_t RECORD_MAGIC
+ *   version      uint32_t
+ *   seed         uint32_t
+ *   num_trolls   uint32_t
+ *   budget       uint32_t, see struct trolls_schedule
+ *   order        uint32_t
+ *   lod_radius   uint32_t
+ *   lod_period   uint32_t
+ *   path_len     uint32_t, 0 for the built-in maze
+ *   maze_path    path_len bytes, not terminated
+ *   runs         until the end of the file: a key byte followed by the number
+ *                of ticks it was pressed for, as a LEB128 varint
+ *
+ * A player holds a key down or keeps still for many ticks in a row, so runs
+ * keep the log down to a few bytes per second of play. Keys outside of a byte
+ * (ncurses function keys, ERR) do nothing in the game and are stored as 0.
+ * Values are in host byte order.
+ */
+#define RECORD_MAGIC 0x524c5254 // "TRLR" read as a little-endian uint32_t
+#define RECORD_VERSION 4
+
+static int
+record_write_u32(FILE* file, uint32_t value)
+{
+  return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+static int
+record_flush_run(struct recorder* rec)
+{
+  if (!rec->run)
+    return 1;
+
+  if (fputc(rec->key, rec->file) == EOF)
+    return 0;
+
+  for (uint64_t run = rec->run; run; run >>= 7)
+    if (fputc((int)(run & 0x7f) | (run >> 7 ? 0x80 : 0), rec->file) == EOF)
+      return 0;
+
+  rec->run = 0;
+  return 1;
+}
+
+// Start recording (game), which has not run yet, to (path)
+// The game was set up with the maze at (maze_path) (NULL for the built-in one)
+//
+// Returns 1 on success, 0 if the file cannot be written
+int
+recorder_open(struct recorder* rec, const char* path, const struct game* game,
+              const char* maze_path)
+{
+  *rec = (struct recorder){ 0 };
+
+  rec->file = fopen(path, "wb");
+  if (!rec->file)
+    return 0;
+
+  const uint32_t path_len = maze_path ? (uint32_t)strlen(maze_path) : 0;
+
+  rec->ok = record_write_u32(rec->file, RECORD_MAGIC) &&
+            record_write_u32(rec->file, RECORD_VERSION) &&
+            record_write_u32(rec->file, game->seed) &&
+            record_write_u32(rec->file, game->trolls.count) &&
+            record_write_u32(rec->file, game->schedule.budget) &&
+            record_write_u32(rec->file, game->schedule.order) &&
+            record_write_u32(rec->file, game->schedule.lod_radius) &&
+            record_write_u32(rec->file, game->schedule.lod_period) &&
+            record_write_u32(rec->file, path_len) &&
+            fwrite(maze_path ? maze_path : "", 1, path_len, rec->file) ==
+              path_len;
+
+  return rec->ok;
+}
+
+// Record the key (key) for the next tick
+void
+recorder_key(struct recorder* rec, int32_t key)
+{
+  const unsigned char stored = key >= 0 && key <= 0xff ? (unsigned char)key : 0;
+
+  if (rec->run && stored != rec->key)
+    rec->ok = record_flush_run(rec) && rec->ok;
+
+  rec->key = stored;
+  rec->run++;
+}
+
+// Finish the recording
+// Returns 1 if the whole recording was written
+int
+recorder_close(struct recorder* rec)
+{
+  if (!rec->file)
+    return 0;
+
+  int ok = record_flush_run(rec) && rec->ok;
+  if (fclose(rec->file) != 0)
+    ok = 0;
+
+  *rec = (struct recorder){ 0 };
+  return ok;
+}
+
+static int
+record_read_u32(FILE* file, uint32_t* value)
+{
+  return fread(value, sizeof(*value), 1, file) == 1;
+}
+
+// Read the run at the current position of (file) into (key) and (run)
+// Returns 0 at the end of the file, -1 if the run is cut short
+static int
+record_read_run(FILE* file, unsigned char* key, uint64_t* run)
+{
+  const int k = fgetc(file);
+  if (k == EOF)
+    return 0;
+
+  *key = (unsigned char)k;
+  *run = 0;
+
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    const int byte = fgetc(file);
+    if (byte == EOF)
+      return -1;
+
+    *run |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return 1;
+  }
+
+  return -1;
+}
+
+static int
+recording_append(struct recording* recording, size_t* capacity,
+                 unsigned char key, uint64_t run)
+{
+  if (run > SIZE_MAX - recording->num_ticks)
+    return 0;
+
+  if (recording->num_ticks + run > *capacity) {
+    size_t grown = *capacity ? *capacity : 4096;
+    while (grown < recording->num_ticks + run)
+      grown *= 2;
+
+    unsigned char* keys = realloc(recording->keys, grown);
+    if (!keys)
+      exit(1);
+
+    recording->keys = keys;
+    *capacity = grown;
+  }
+
+  memset(recording->keys + recording->num_ticks, key, run);
+  recording->num_ticks += run;
+  return 1;
+}
+
+// Load the recording at (path), with the key of every tick expanded
+//
+// Returns 1 on success, 0 if the file cannot be read or is not a recording
+int
+recording_load(struct recording* recording, const char* path)
+{
+  *recording = (struct recording){ 0 };
+
+  FILE* file = fopen(path, "rb");
+  if (!file)
+    return 0;
+
+  uint32_t magic, version, path_len, order;
+  int ok = record_read_u32(file, &magic) && magic == RECORD_MAGIC &&
+           record_read_u32(file, &version) && version == RECORD_VERSION &&
+           record_read_u32(file, &recording->seed) &&
+           record_read_u32(file, &recording->num_trolls) &&
+           record_read_u32(file, &recording->budget) &&
+           record_read_u32(file, &order) && order <= TROLLS_NEAREST_FIRST &&
+           record_read_u32(file, &recording->lod_radius) &&
+           record_read_u32(file, &recording->lod_period) &&
+           record_read_u32(file, &path_len);
+  recording->order = (enum trolls_order)order;
+
+  if (ok && path_len) {
+    recording->maze_path = malloc((size_t)path_len + 1);
+    if (!recording->maze_path)
+      exit(1);
+
+    ok = fread(recording->maze_path, 1, path_len, file) == path_len;
+    recording->maze_path[path_len] = '\0';
+  }
+
+  size_t capacity = 0;
+  unsigned char key;
+  uint64_t run;
+  int more;
+  while (ok && (more = record_read_run(file, &key, &run)) != 0)
+    ok = more > 0 && recording_append(recording, &capacity, key, run);
+
+  fclose(file);
+
+  if (!ok)
+    recording_free(recording);
+
+  return ok;
+}
+
+void
+recording_free(struct recording* recording)
+{
+  free(recording->maze_path);
+  free(recording->keys);
+  *recording = (struct recording){ 0 };
+}
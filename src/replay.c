@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game.h"
+
+// Replay a recording made with `trolls -r` or `trolls_sim -o` headlessly, as
+// fast as it goes
+
+int main(int argc, char* argv[]);
+
+static void
+usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [-c every] [-s tick] [-j threads] <log>\n",
+          prog);
+  fprintf(stderr, "  -c  checkpoint the game every (every) ticks\n");
+  fprintf(stderr, "  -s  after the replay, seek back to tick (tick)\n");
+  fprintf(stderr, "  -j  threads to plan troll paths on (default 1)\n");
+}
+
+static double
+replay_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int
+replay_number(const char* str, unsigned long* value)
+{
+  char* end;
+  *value = strtoul(str, &end, 10);
+  return *str && !*end;
+}
+
+// Set up the game the recording starts from
+static struct game*
+replay_game(const struct recording* recording, uint32_t threads)
+{
+  struct game* game = game_new(recording->maze_path, recording->seed);
+  if (!game)
+    return NULL;
+
+  game_set_trolls(game, recording->num_trolls);
+  game_set_schedule(game, recording->budget, recording->order);
+  game_set_lod(game, recording->lod_radius, recording->lod_period);
+  game_set_threads(game, threads);
+
+  return game;
+}
+
+// Play the recorded ticks from the current tick of the game up to (end)
+// Returns the number of games won and lost in (wins) and (losses)
+static void
+replay_run(struct game* game, const struct recording* recording, size_t end,
+           unsigned long* wins, unsigned long* losses)
+{
+  while (game->tick < end) {
+    game_tick(game, recording->keys[game->tick]);
+
+    const enum game_state state = game_continue(game);
+    *wins += state == GAME_WIN;
+    *losses += state == GAME_LOSE;
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  unsigned long every = 0;
+  unsigned long seek = 0;
+  unsigned long threads = 1;
+  int seeking = 0;
+
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    const char* opt = argv[arg];
+    const char* value = arg + 1 < argc ? argv[arg + 1] : NULL;
+    int ok = value != NULL;
+
+    if (ok && strcmp(opt, "-c") == 0)
+      ok = replay_number(value, &every);
+    else if (ok && strcmp(opt, "-s") == 0)
+      ok = seeking = replay_number(value, &seek);
+    else if (ok && strcmp(opt, "-j") == 0)
+      ok = replay_number(value, &threads) && threads <= 1024;
+    else
+      ok = 0;
+
+    if (!ok) {
+      usage(argv[0]);
+      return 1;
+    }
+    arg++;
+  }
+
+  if (argc - arg != 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  struct recording recording;
+  if (!recording_load(&recording, argv[arg])) {
+    fprintf(stderr, "%s: could not load recording '%s'\n", argv[0],
+            argv[arg]);
+    return 1;
+  }
+
+  struct game* game = replay_game(&recording, (uint32_t)threads);
+  if (!game) {
+    fprintf(stderr, "%s: could not load maze '%s'\n", argv[0],
+            recording.maze_path);
+    recording_free(&recording);
+    return 1;
+  }
+
+  // Checkpoints are taken at tick 0, every, 2 * every...
+  const size_t num_checkpoints =
+    every ? recording.num_ticks / every + 1 : 0;
+  struct game_checkpoint* checkpoints =
+    calloc(num_checkpoints ? num_checkpoints : 1, sizeof(*checkpoints));
+  if (!checkpoints)
+    exit(1);
+
+  unsigned long wins = 0, losses = 0;
+  double checkpoint_time = 0;
+  const double start = replay_now();
+
+  for (size_t c = 0; c < num_checkpoints; c++) {
+    replay_run(game, &recording, c * every, &wins, &losses);
+
+    const double before = replay_now();
+    game_checkpoint_save(game, &checkpoints[c]);
+    checkpoint_time += replay_now() - before;
+  }
+  replay_run(game, &recording, recording.num_ticks, &wins, &losses);
+
+  const double seconds = replay_now() - start;
+
+  printf("%zu ticks, %u trolls, %.3f s, %.1f ticks/s\n", recording.num_ticks,
+         game->trolls.count, seconds, (double)recording.num_ticks / seconds);
+  if (num_checkpoints)
+    printf("%zu checkpoints, %.3f ms each\n", num_checkpoints,
+           checkpoint_time * 1e3 / (double)num_checkpoints);
+  printf("%lu wins, %lu losses\n", wins, losses);
+  printf("state hash: %016llx\n", (unsigned long long)game_hash(game));
+
+  if (seeking && seek <= recording.num_ticks) {
+    // From the closest checkpoint before (seek) if there is one, from the
+    // start otherwise
+    const double before = replay_now();
+    if (num_checkpoints) {
+      game_checkpoint_restore(game, &checkpoints[seek / every]);
+    } else {
+      game_delete(game);
+      game = replay_game(&recording, (uint32_t)threads);
+    }
+    replay_run(game, &recording, seek, &wins, &losses);
+
+    printf("seek to tick %lu: %.3f ms, state hash: %016llx\n", seek,
+           (replay_now() - before) * 1e3,
+           (unsigned long long)game_hash(game));
+  }
+
+  for (size_t c = 0; c < num_checkpoints; c++)
+    game_checkpoint_free(&checkpoints[c]);
+  free(checkpoints);
+
+  game_delete(game);
+  recording_free(&recording);
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "game.h"
+
+/* xoshiro256** by David Blackman and Sebastiano Vigna, seeded with splitmix64
+ * as its authors suggest
+ *
+ * Numbers below a bound are taken from the high 32 bits of a draw multiplied
+ * by the bound, which is off from uniform by at most bound / 2^32; the
+ * bounds here are maze sizes, far too small for that to show.
+ */
+
+static uint64_t
+rng_rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t
+rng_splitmix(uint64_t* x)
+{
+  uint64_t z = (*x += UINT64_C(0x9e3779b97f4a7c15));
+  z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return z ^ (z >> 31);
+}
+
+void
+rng_seed(struct rng* rng, uint64_t seed)
+{
+  for (size_t i = 0; i < 4; i++)
+    rng->state[i] = rng_splitmix(&seed);
+}
+
+uint64_t
+rng_next(struct rng* rng)
+{
+  uint64_t* s = rng->state;
+  const uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rng_rotl(s[3], 45);
+
+  return result;
+}
+
+uint32_t
+rng_below(struct rng* rng, uint32_t bound)
+{
+  return (uint32_t)(((rng_next(rng) >> 32) * bound) >> 32);
+}
+
+// Each draw makes two numbers, one from either half
+void
+rng_fill_below(struct rng* rng, uint32_t* values, size_t count,
+               uint32_t bound)
+{
+  size_t i = 0;
+  for (; i + 1 < count; i += 2) {
+    const uint64_t r = rng_next(rng);
+    values[i] = (uint32_t)(((r >> 32) * bound) >> 32);
+    values[i + 1] = (uint32_t)(((r & UINT32_MAX) * bound) >> 32);
+  }
+
+  if (i < count)
+    values[i] = rng_below(rng, bound);
+}
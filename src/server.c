@@ -0,0 +1,437 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game.h"
+
+// Host many games in one process, headless. The games are split into shards,
+// one per worker thread, and each worker steps the games of its shard at a
+// fixed tick rate. All the games play on one copy of the maze.
+//
+// Players send their keys on stdin, one command per line:
+//   <game> <key>  the player of game <game> presses <key> (w/a/s/d); the last
+//                 key pressed before a tick is the one that counts
+//   <game> ?      print the state of game <game> after its next tick
+//   q             stop the server
+//
+// Every shard reports its tick times at the end. Build without PATH_TRACE
+// to time it: traced path searches from all the shards write to one stderr,
+// and waiting on it would make up most of those times.
+
+int main(int argc, char* argv[]);
+
+static void
+usage(const char* prog)
+{
+  fprintf(stderr,
+          "usage: %s [-g games] [-w workers] [-t trolls] [-r rate] "
+          "[-d seconds] [-s seed] [-m] [maze]\n",
+          prog);
+  fprintf(stderr, "  -g  number of games (default 1000)\n");
+  fprintf(stderr, "  -w  worker threads, each with a shard of the games "
+                  "(default 4)\n");
+  fprintf(stderr, "  -t  number of trolls in each game (default 4)\n");
+  fprintf(stderr, "  -r  ticks per second of every game, 0 for as fast as "
+                  "it goes (default 10)\n");
+  fprintf(stderr, "  -d  seconds to run, 0 until q or the end of the input "
+                  "(default 10)\n");
+  fprintf(stderr, "  -s  seed of the first game, the next ones count up "
+                  "(default 1)\n");
+  fprintf(stderr, "  -m  start a new match when a game is over, instead of "
+                  "a new player\n");
+}
+
+// What the input thread leaves for the worker of a game
+struct server_inbox
+{
+  atomic_int key; // 0 for none
+  atomic_bool query;
+};
+
+struct server_shard
+{
+  pthread_t thread;
+  uint32_t first; // number of the first game of the shard
+  uint32_t num_games;
+  struct game** games;
+  struct server_inbox* inbox;
+  uint64_t period_ns; // 0 to run flat out
+
+  // Games of new matches come from (pool), with the seed of the match before
+  // plus the number of games; (num_trolls) trolls each
+  bool matches;
+  struct game_pool pool;
+  uint32_t num_trolls;
+  uint32_t seed_step;
+  unsigned long num_matches;
+
+  // Time taken by each tick of all the games of the shard
+  uint64_t* tick_ns;
+  size_t num_ticks;
+  size_t capacity;
+
+  uint64_t overruns; // ticks that ran past the next one's start
+  unsigned long wins;
+  unsigned long losses;
+  uint64_t elapsed_ns;
+};
+
+struct server_input
+{
+  struct server_inbox* inbox;
+  uint32_t num_games;
+  bool stop_at_end; // stop the server at the end of the input
+};
+
+static atomic_bool server_running = true;
+
+static uint64_t
+server_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void
+server_sleep_until(uint64_t ns)
+{
+  const struct timespec until = {
+    .tv_sec = (time_t)(ns / 1000000000),
+    .tv_nsec = (long)(ns % 1000000000),
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL))
+    ;
+}
+
+static int
+server_compare_ns(const void* a, const void* b)
+{
+  const uint64_t na = *(const uint64_t*)a;
+  const uint64_t nb = *(const uint64_t*)b;
+
+  return (na > nb) - (na < nb);
+}
+
+// Returns the (p) percentile of the (n) sorted times (ns)
+static double
+server_percentile_us(const uint64_t* ns, size_t n, double p)
+{
+  if (!n)
+    return 0;
+
+  size_t i = (size_t)(p / 100 * (double)n);
+  if (i >= n)
+    i = n - 1;
+
+  return (double)ns[i] / 1e3;
+}
+
+// Parse the number in (str) into (value)
+// Returns 0 if (str) is not a number
+static int
+server_number(const char* str, unsigned long* value)
+{
+  char* end;
+  *value = strtoul(str, &end, 10);
+  return *str && !*end;
+}
+
+static void
+server_record_tick(struct server_shard* shard, uint64_t ns)
+{
+  if (shard->num_ticks == shard->capacity) {
+    shard->capacity = shard->capacity ? shard->capacity * 2 : 1024;
+    shard->tick_ns =
+      realloc(shard->tick_ns, shard->capacity * sizeof(*shard->tick_ns));
+    if (!shard->tick_ns)
+      exit(1);
+  }
+
+  shard->tick_ns[shard->num_ticks++] = ns;
+}
+
+// Step the games of a shard, once every period, until the server stops
+static void*
+server_shard_run(void* arg)
+{
+  struct server_shard* shard = arg;
+  const uint64_t start = server_now();
+  uint64_t next = start;
+
+  while (atomic_load(&server_running)) {
+    const uint64_t before = server_now();
+
+    for (uint32_t g = 0; g < shard->num_games; g++) {
+      struct game* game = shard->games[g];
+      struct server_inbox* inbox = &shard->inbox[g];
+
+      game_tick(game, atomic_exchange(&inbox->key, 0));
+
+      // Keep going with a new player when the game is over, or a new game
+      const enum game_state state =
+        shard->matches ? game->state : game_continue(game);
+      shard->wins += state == GAME_WIN;
+      shard->losses += state == GAME_LOSE;
+
+      if (shard->matches && state != GAME_NONE) {
+        const uint32_t seed = game->seed + shard->seed_step;
+
+        game_pool_put(&shard->pool, game);
+        game = shard->games[g] = game_pool_get(&shard->pool, seed);
+        game_set_trolls(game, shard->num_trolls);
+        shard->num_matches++;
+      }
+
+      if (atomic_exchange(&inbox->query, false)) {
+        printf("game %u tick %llu player %u %u %s hash %016llx\n",
+               shard->first + g, (unsigned long long)game->tick,
+               game->player->loc.x, game->player->loc.y,
+               state == GAME_WIN    ? "won"
+               : state == GAME_LOSE ? "lost"
+                                    : "playing",
+               (unsigned long long)game_hash(game));
+        fflush(stdout);
+      }
+    }
+
+    const uint64_t after = server_now();
+    server_record_tick(shard, after - before);
+
+    if (!shard->period_ns)
+      continue;
+
+    // A late tick pushes the next ones back rather than bunching them up
+    next += shard->period_ns;
+    if (after > next) {
+      shard->overruns++;
+      next = after;
+    } else {
+      server_sleep_until(next);
+    }
+  }
+
+  shard->elapsed_ns = server_now() - start;
+  return NULL;
+}
+
+static void*
+server_read_input(void* arg)
+{
+  const struct server_input* input = arg;
+  char line[64];
+
+  while (fgets(line, sizeof(line), stdin)) {
+    unsigned long game;
+    char key;
+
+    if (line[0] == 'q')
+      break;
+
+    if (sscanf(line, "%lu %c", &game, &key) != 2 ||
+        game >= input->num_games) {
+      fprintf(stderr, "bad command: %s", line);
+      continue;
+    }
+
+    if (key == '?')
+      atomic_store(&input->inbox[game].query, true);
+    else
+      atomic_store(&input->inbox[game].key, key);
+  }
+
+  if (!feof(stdin) || input->stop_at_end)
+    atomic_store(&server_running, false);
+
+  return NULL;
+}
+
+int
+main(int argc, char* argv[])
+{
+  unsigned long num_games = 1000;
+  unsigned long num_workers = 4;
+  unsigned long num_trolls = 4;
+  unsigned long rate = 10;
+  unsigned long seconds = 10;
+  unsigned long seed = 1;
+  bool matches = false;
+
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    const char* opt = argv[arg];
+    const char* value = arg + 1 < argc ? argv[arg + 1] : NULL;
+    int ok = value != NULL;
+
+    if (strcmp(opt, "-m") == 0) {
+      matches = true;
+      continue;
+    }
+
+    if (ok && strcmp(opt, "-g") == 0)
+      ok = server_number(value, &num_games) && num_games &&
+           num_games < UINT32_MAX;
+    else if (ok && strcmp(opt, "-w") == 0)
+      ok = server_number(value, &num_workers) && num_workers &&
+           num_workers <= 1024;
+    else if (ok && strcmp(opt, "-t") == 0)
+      ok = server_number(value, &num_trolls) && num_trolls < UINT32_MAX;
+    else if (ok && strcmp(opt, "-r") == 0)
+      ok = server_number(value, &rate) && rate <= 1000000;
+    else if (ok && strcmp(opt, "-d") == 0)
+      ok = server_number(value, &seconds);
+    else if (ok && strcmp(opt, "-s") == 0)
+      ok = server_number(value, &seed);
+    else
+      ok = 0;
+
+    if (!ok) {
+      usage(argv[0]);
+      return 1;
+    }
+    arg++;
+  }
+
+  if (argc - arg > 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (num_workers > num_games)
+    num_workers = num_games;
+
+  // The games share the maze of this one, which does not play itself
+  const char* maze_path = arg < argc ? argv[arg] : NULL;
+  struct game* host = game_new(maze_path, (uint32_t)seed);
+  if (!host) {
+    fprintf(stderr, "%s: could not load maze '%s'\n", argv[0], maze_path);
+    return 1;
+  }
+
+  const uint64_t setup_start = server_now();
+
+  struct game** games = calloc(num_games, sizeof(*games));
+  struct server_inbox* inbox = calloc(num_games, sizeof(*inbox));
+  struct server_shard* shards = calloc(num_workers, sizeof(*shards));
+  if (!games || !inbox || !shards)
+    exit(1);
+
+  // Each shard takes the next run of games, made by its own pool
+  for (uint32_t s = 0; s < num_workers; s++) {
+    const uint32_t first = (uint32_t)(num_games * s / num_workers);
+    const uint32_t last = (uint32_t)(num_games * (s + 1) / num_workers);
+    struct server_shard* shard = &shards[s];
+
+    *shard = (struct server_shard){
+      .first = first,
+      .num_games = last - first,
+      .games = games + first,
+      .inbox = inbox + first,
+      .period_ns = rate ? 1000000000 / rate : 0,
+      .matches = matches,
+      .num_trolls = (uint32_t)num_trolls,
+      .seed_step = (uint32_t)num_games,
+    };
+    game_pool_init(&shard->pool, &host->maze);
+
+    for (uint32_t i = first; i < last; i++) {
+      games[i] = game_pool_get(&shard->pool, (uint32_t)(seed + i));
+      if (!games[i]) {
+        fprintf(stderr, "%s: a paged maze cannot be shared between games\n",
+                argv[0]);
+        return 1;
+      }
+
+      game_set_trolls(games[i], (uint32_t)num_trolls);
+      atomic_init(&inbox[i].key, 0);
+      atomic_init(&inbox[i].query, false);
+    }
+  }
+
+  printf("%lu games on one %ux%u maze, set up in %.3f s\n", num_games,
+         host->maze.maze_width, host->maze.maze_height,
+         (double)(server_now() - setup_start) / 1e9);
+  fflush(stdout);
+
+  for (uint32_t s = 0; s < num_workers; s++)
+    if (pthread_create(&shards[s].thread, NULL, server_shard_run, &shards[s]))
+      exit(1);
+
+  // The input thread may be stuck reading when the server stops; it is left
+  // to end with the process
+  struct server_input input = {
+    .inbox = inbox,
+    .num_games = (uint32_t)num_games,
+    .stop_at_end = !seconds,
+  };
+  pthread_t input_thread;
+  if (pthread_create(&input_thread, NULL, server_read_input, &input) ||
+      pthread_detach(input_thread))
+    exit(1);
+
+  const uint64_t end = server_now() + (uint64_t)seconds * 1000000000;
+  while (atomic_load(&server_running) && (!seconds || server_now() < end)) {
+    const struct timespec nap = {.tv_nsec = 10000000 };
+    nanosleep(&nap, NULL);
+  }
+  atomic_store(&server_running, false);
+
+  for (uint32_t s = 0; s < num_workers; s++)
+    pthread_join(shards[s].thread, NULL);
+
+  // Every shard reports how long a tick of all its games took
+  printf("shard  games    ticks  game ticks/s   p50 us   p99 us   max us"
+         "  overruns\n");
+
+  double total_rate = 0;
+  unsigned long wins = 0, losses = 0, num_matches = 0, num_made = 0;
+  for (uint32_t s = 0; s < num_workers; s++) {
+    struct server_shard* shard = &shards[s];
+    const double shard_rate = (double)shard->num_ticks * shard->num_games /
+                              ((double)shard->elapsed_ns / 1e9);
+
+    qsort(shard->tick_ns, shard->num_ticks, sizeof(*shard->tick_ns),
+          server_compare_ns);
+    printf("%5u %6u %8zu %13.1f %8.1f %8.1f %8.1f %9llu\n", s,
+           shard->num_games, shard->num_ticks, shard_rate,
+           server_percentile_us(shard->tick_ns, shard->num_ticks, 50),
+           server_percentile_us(shard->tick_ns, shard->num_ticks, 99),
+           server_percentile_us(shard->tick_ns, shard->num_ticks, 100),
+           (unsigned long long)shard->overruns);
+
+    total_rate += shard_rate;
+    wins += shard->wins;
+    losses += shard->losses;
+    num_matches += shard->num_matches;
+    num_made += shard->pool.num_made;
+    free(shard->tick_ns);
+  }
+
+  printf("%.1f game ticks/s in all, %lu wins, %lu losses\n", total_rate, wins,
+         losses);
+  if (matches)
+    printf("%lu new matches, %lu games made for %lu slots\n", num_matches,
+           num_made, num_games);
+
+  for (uint32_t s = 0; s < num_workers; s++) {
+    struct server_shard* shard = &shards[s];
+
+    for (uint32_t g = 0; g < shard->num_games; g++)
+      game_pool_put(&shard->pool, shard->games[g]);
+    game_pool_destroy(&shard->pool);
+  }
+  game_delete(host);
+  free(games);
+  free(inbox);
+  free(shards);
+
+  return 0;
+}
@@ -0,0 +1,335 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game.h"
+#include "troll.h"
+
+// Headless simulation: run the game as fast as it goes, without a terminal,
+// for load testing and server-side simulation
+
+int main(int argc, char* argv[]);
+
+// The phases of a tick, in the order game_tick() runs them
+enum sim_phase
+{
+  SIM_PLAYER,
+  SIM_TROLLS,
+  SIM_STATUS,
+  SIM_PHASES,
+};
+
+static const char* sim_phase_names[SIM_PHASES] = {
+  [SIM_PLAYER] = "player",
+  [SIM_TROLLS] = "trolls",
+  [SIM_STATUS] = "status",
+};
+
+static const char* sim_pool_names[POOL_KINDS] = {
+  [POOL_ENTITY] = "entity",
+  [POOL_PATH] = "path",
+  [POOL_STEPS] = "steps",
+  [POOL_SCRATCH] = "scratch",
+};
+
+// Returns the number of allocations made from the system so far
+static uint64_t
+sim_system_allocs(void)
+{
+  uint64_t system = 0;
+  for (size_t k = 0; k < POOL_KINDS; k++)
+    system += pool_stats((enum pool_kind)k).system;
+
+  return system;
+}
+
+static void
+usage(const char* prog)
+{
+  fprintf(stderr,
+          "usage: %s [-n ticks] [-t trolls] [-j threads] [-s keys] [-r seed] "
+          "[-b budget] [-p order] [-L radius] [-P period] [-o log] "
+          "[-l snapshot] [-w snapshot] [maze]\n",
+          prog);
+  fprintf(stderr, "  -n  number of ticks to run (default 10000)\n");
+  fprintf(stderr, "  -t  number of trolls (default 4)\n");
+  fprintf(stderr, "  -j  threads to plan troll paths on (default 1)\n");
+  fprintf(stderr, "  -s  keys the player presses, one per tick, repeated\n");
+  fprintf(stderr, "      (default: a random one of w/a/s/d every tick)\n");
+  fprintf(stderr, "  -r  random seed (default 1)\n");
+  fprintf(stderr, "  -b  path searches per tick (default 0, no limit)\n");
+  fprintf(stderr, "  -p  trolls served first when over budget: rr, in turn\n");
+  fprintf(stderr, "      (default), or near, nearest to the player\n");
+  fprintf(stderr, "  -L  trolls further than (radius) from the player only\n");
+  fprintf(stderr, "      move every (period) ticks (default 0, all of them\n");
+  fprintf(stderr, "      move every tick)\n");
+  fprintf(stderr, "  -P  ticks between the moves of far trolls (default 8)\n");
+  fprintf(stderr, "  -o  record the keys to (log), see trolls_replay\n");
+  fprintf(stderr, "  -l  pick up the game saved in (snapshot)\n");
+  fprintf(stderr, "  -w  save the game to (snapshot) at the end\n");
+}
+
+static uint64_t
+sim_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static int
+sim_compare_ns(const void* a, const void* b)
+{
+  const uint64_t na = *(const uint64_t*)a;
+  const uint64_t nb = *(const uint64_t*)b;
+
+  return (na > nb) - (na < nb);
+}
+
+// Returns the (p) percentile of the (n) sorted times (ns)
+static double
+sim_percentile_us(const uint64_t* ns, size_t n, double p)
+{
+  if (!n)
+    return 0;
+
+  size_t i = (size_t)(p / 100 * (double)n);
+  if (i >= n)
+    i = n - 1;
+
+  return (double)ns[i] / 1e3;
+}
+
+// Parse the number in (str) into (value)
+// Returns 0 if (str) is not a number
+static int
+sim_number(const char* str, unsigned long* value)
+{
+  char* end;
+  *value = strtoul(str, &end, 10);
+  return *str && !*end;
+}
+
+// Returns a random one of w/a/s/d for (tick)
+// Not drawn from game->rng, which would change what the trolls do in a way a
+// replay of the keys cannot repeat
+static int32_t
+sim_key(uint32_t seed, uint64_t tick)
+{
+  uint64_t mix = ((uint64_t)seed << 32) + tick * UINT64_C(0x9e3779b97f4a7c15);
+  mix = (mix ^ (mix >> 31)) * UINT64_C(0xd6e8feb86659fd93);
+  mix ^= mix >> 32;
+
+  return "wasd"[mix & 3];
+}
+
+int
+main(int argc, char* argv[])
+{
+  unsigned long ticks = 10000;
+  unsigned long num_trolls = 4;
+  unsigned long seed = 1;
+  unsigned long threads = 1;
+  unsigned long budget = 0;
+  enum trolls_order order = TROLLS_ROUND_ROBIN;
+  unsigned long lod_radius = 0;
+  unsigned long lod_period = 8;
+  int scheduled = 0;
+  int lod = 0;
+  const char* script = NULL;
+  const char* log_path = NULL;
+  const char* load_path = NULL;
+  const char* save_path = NULL;
+
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    const char* opt = argv[arg];
+    const char* value = arg + 1 < argc ? argv[arg + 1] : NULL;
+    int ok = value != NULL;
+
+    if (ok && strcmp(opt, "-n") == 0)
+      ok = sim_number(value, &ticks);
+    else if (ok && strcmp(opt, "-t") == 0)
+      ok = sim_number(value, &num_trolls) && num_trolls < UINT32_MAX;
+    else if (ok && strcmp(opt, "-j") == 0)
+      ok = sim_number(value, &threads) && threads <= 1024;
+    else if (ok && strcmp(opt, "-r") == 0)
+      ok = sim_number(value, &seed);
+    else if (ok && strcmp(opt, "-b") == 0)
+      ok = scheduled = sim_number(value, &budget) && budget <= UINT32_MAX;
+    else if (ok && strcmp(opt, "-p") == 0 && strcmp(value, "rr") == 0) {
+      order = TROLLS_ROUND_ROBIN;
+      scheduled = 1;
+    } else if (ok && strcmp(opt, "-p") == 0 && strcmp(value, "near") == 0) {
+      order = TROLLS_NEAREST_FIRST;
+      scheduled = 1;
+    } else if (ok && strcmp(opt, "-L") == 0)
+      ok = lod = sim_number(value, &lod_radius) && lod_radius <= UINT32_MAX;
+    else if (ok && strcmp(opt, "-P") == 0)
+      ok = sim_number(value, &lod_period) && lod_period <= UINT32_MAX;
+    else if (ok && strcmp(opt, "-s") == 0 && *value)
+      script = value;
+    else if (ok && strcmp(opt, "-o") == 0)
+      log_path = value;
+    else if (ok && strcmp(opt, "-l") == 0)
+      load_path = value;
+    else if (ok && strcmp(opt, "-w") == 0)
+      save_path = value;
+    else
+      ok = 0;
+
+    if (!ok) {
+      usage(argv[0]);
+      return 1;
+    }
+    arg++;
+  }
+
+  // A recording starts from a new game
+  if (argc - arg > 1 || (load_path && (argc - arg > 0 || log_path))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char* maze_path = arg < argc ? argv[arg] : NULL;
+  struct game* game;
+
+  if (load_path) {
+    // The seed and the trolls come with the snapshot
+    const uint64_t before = sim_now();
+    game = game_snapshot_load(load_path);
+    if (!game) {
+      fprintf(stderr, "%s: could not load snapshot '%s'\n", argv[0],
+              load_path);
+      return 1;
+    }
+    printf("loaded snapshot at tick %llu in %.3f ms\n",
+           (unsigned long long)game->tick, (double)(sim_now() - before) / 1e6);
+
+    seed = game->seed;
+  } else {
+    game = game_new(maze_path, (uint32_t)seed);
+    if (!game) {
+      fprintf(stderr, "%s: could not load maze '%s'\n", argv[0], maze_path);
+      return 1;
+    }
+
+    game_set_trolls(game, (uint32_t)num_trolls);
+  }
+
+  game_set_threads(game, (uint32_t)threads);
+
+  // A snapshot keeps the schedule it was saved with, unless told otherwise
+  if (scheduled || !load_path)
+    game_set_schedule(game, (uint32_t)budget, order);
+  if (lod)
+    game_set_lod(game, (uint32_t)lod_radius, (uint32_t)lod_period);
+
+  struct recorder rec = { 0 };
+  if (log_path && !recorder_open(&rec, log_path, game, maze_path)) {
+    fprintf(stderr, "%s: could not write '%s'\n", argv[0], log_path);
+    game_delete(game);
+    return 1;
+  }
+
+  uint64_t phase_ns[SIM_PHASES] = { 0 };
+  uint64_t half_system = 0; // allocations from the system at half time
+  uint64_t* tick_ns = malloc((ticks ? ticks : 1) * sizeof(*tick_ns));
+  if (!tick_ns)
+    exit(1);
+  unsigned long wins = 0, losses = 0;
+  const size_t script_len = script ? strlen(script) : 0;
+
+  const uint64_t start = sim_now();
+
+  for (unsigned long tick = 0; tick < ticks; tick++) {
+    if (tick == ticks / 2)
+      half_system = sim_system_allocs();
+
+    // The keys follow the tick of the game, so that a game picked up from a
+    // snapshot gets the keys it would have had
+    const int32_t key = script ? script[game->tick % script_len]
+                               : sim_key((uint32_t)seed, game->tick);
+    if (rec.file)
+      recorder_key(&rec, key);
+
+    // The phases of game_tick(), timed one by one
+    game_begin_tick(game);
+    uint64_t t0 = sim_now();
+    game_update_player(game, key);
+    uint64_t t1 = sim_now();
+    game_update_trolls(game);
+    uint64_t t2 = sim_now();
+    game_get_status(game);
+    uint64_t t3 = sim_now();
+
+    phase_ns[SIM_PLAYER] += t1 - t0;
+    phase_ns[SIM_TROLLS] += t2 - t1;
+    phase_ns[SIM_STATUS] += t3 - t2;
+    tick_ns[tick] = t3 - t0;
+
+    // Keep going with a new player when the game is over
+    const enum game_state state = game_continue(game);
+    wins += state == GAME_WIN;
+    losses += state == GAME_LOSE;
+  }
+
+  const double seconds = (double)(sim_now() - start) / 1e9;
+
+  printf("%lu ticks, %u trolls, %u threads, %.3f s, %.1f ticks/s\n", ticks,
+         game->trolls.count, job_pool_threads(game->jobs), seconds,
+         (double)ticks / seconds);
+  for (size_t p = 0; p < SIM_PHASES; p++)
+    printf("  %-7s %10.3f ms %10.3f us/tick\n", sim_phase_names[p],
+           (double)phase_ns[p] / 1e6,
+           ticks ? (double)phase_ns[p] / 1e3 / (double)ticks : 0.0);
+  // The spikes are what a player notices
+  qsort(tick_ns, ticks, sizeof(*tick_ns), sim_compare_ns);
+  printf("tick time: p50 %.1f us, p99 %.1f us, max %.1f us "
+         "(budget %u, %s)\n",
+         sim_percentile_us(tick_ns, ticks, 50),
+         sim_percentile_us(tick_ns, ticks, 99),
+         sim_percentile_us(tick_ns, ticks, 100), game->schedule.budget,
+         game->schedule.order == TROLLS_NEAREST_FIRST ? "near" : "rr");
+  free(tick_ns);
+  if (game->schedule.lod_period > 1)
+    printf("far trolls: further than %u, every %u ticks\n",
+           game->schedule.lod_radius, game->schedule.lod_period);
+
+  printf("%lu wins, %lu losses\n", wins, losses);
+
+  // Once warmed up, ticks should not need memory from the system
+  for (size_t k = 0; k < POOL_KINDS; k++) {
+    const struct pool_stats stats = pool_stats((enum pool_kind)k);
+    printf("  %-7s %10llu allocs %10llu frees %6llu from the system\n",
+           sim_pool_names[k], (unsigned long long)stats.allocs,
+           (unsigned long long)stats.frees, (unsigned long long)stats.system);
+  }
+  printf("%llu allocations from the system in the last %lu ticks\n",
+         (unsigned long long)(sim_system_allocs() - half_system),
+         ticks - ticks / 2);
+
+  if (rec.file && !recorder_close(&rec))
+    fprintf(stderr, "%s: could not write '%s'\n", argv[0], log_path);
+
+  // To compare runs
+  printf("state hash: %016llx\n", (unsigned long long)game_hash(game));
+
+  if (save_path) {
+    const uint64_t before = sim_now();
+    if (game_snapshot_save(game, save_path))
+      printf("saved snapshot in %.3f ms\n",
+             (double)(sim_now() - before) / 1e6);
+    else
+      fprintf(stderr, "%s: could not save snapshot '%s'\n", argv[0],
+              save_path);
+  }
+
+  game_delete(game);
+
+  return 0;
+}
@@ -0,0 +1,585 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "game.h"
+#include "path.h"
+#include "troll.h"
+
+/* Game snapshots
+ *
+ * A snapshot holds the whole state of a game in one flat file, laid out like
+ * a binary maze (see src/maze_bin.c) so that it can be mapped and used in
+ * place:
+ *
+ *   header       struct snapshot_header
+ *   cells        maze_size() bytes in the layout of the maze, starting on a
+ *                page boundary
+ *   rays         4 * maze_size() uint16_t wall distances (SNAPSHOT_RAYS only)
+ *   components   width * height uint32_t labels (SNAPSHOT_COMPONENTS only)
+ *   exits        num_exits uint32_t cell ids
+ *   journal      MAZE_JOURNAL_LENGTH struct maze_change (SNAPSHOT_JOURNAL)
+ *   trolls       loc, face and handle of num_handles trolls, then index, one
+ *                array after the other
+ *   paths        num_trolls + 1 struct snapshot_path, the last one is the
+ *                player's
+ *   steps        the steps of every path, one after the other
+ *
+ * Every section starts on an 8 byte boundary. Nothing in the file is a
+ * pointer, sections are found by their offset from the start of the file.
+ *
+ * Loading maps the file and points the cells, rays and components of the maze
+ * straight into the mapping, so the bulk of a snapshot is never copied. What
+ * the game grows and frees as it runs (exits, journal, trolls and their
+ * paths) is copied out into allocations of its own.
+ *
+ * Random numbers are seeded from the seed and the tick (see
+ * game_begin_tick()), which is all the state they have. A loaded game plays on
+ * exactly as the saved one would have.
+ */
+#define SNAPSHOT_MAGIC 0x534c5254 // "TRLS" read as a little-endian uint32_t
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_PAGE 4096
+
+// Marks a path that is not there in snapshot_path.first
+#define SNAPSHOT_NO_PATH UINT64_MAX
+
+enum snapshot_flags
+{
+  SNAPSHOT_TILED = 1 << 0,
+  SNAPSHOT_RAYS = 1 << 1,
+  SNAPSHOT_COMPONENTS = 1 << 2,
+  SNAPSHOT_JOURNAL = 1 << 3,
+};
+
+struct snapshot_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+
+  // The game
+  uint32_t seed;
+  uint64_t tick;
+  uint32_t state;
+  uint32_t player_vision;
+  uint32_t player_x;
+  uint32_t player_y;
+  uint32_t player_face;
+  uint32_t budget; // see struct trolls_schedule
+  uint32_t order;
+  uint32_t lod_radius;
+  uint32_t lod_period;
+
+  // The maze
+  uint32_t width;
+  uint32_t height;
+  uint32_t num_exits;
+  uint64_t generation;
+
+  // The trolls
+  uint32_t num_trolls;
+  uint32_t num_handles;
+  uint64_t num_steps; // of all paths together
+
+  uint64_t cells_offset;
+  uint64_t rays_offset;
+  uint64_t components_offset;
+  uint64_t exits_offset;
+  uint64_t journal_offset;
+  uint64_t trolls_offset;
+  uint64_t paths_offset;
+  uint64_t steps_offset;
+  uint64_t size; // size of the whole file
+};
+
+struct snapshot_path
+{
+  uint64_t next;
+  uint64_t num_steps;
+  uint64_t first; // index of the first step, or SNAPSHOT_NO_PATH
+};
+
+// The troll arrays are stored one after the other at trolls_offset
+#define SNAPSHOT_TROLL_SIZE                                                    \
+  (sizeof(struct location) + sizeof(enum direction) + 2 * sizeof(uint32_t))
+
+static uint64_t
+snapshot_align(uint64_t offset, uint64_t align)
+{
+  return (offset + align - 1) & ~(align - 1);
+}
+
+// Returns the path of the troll at (i), or of the player for (i) == count
+static const struct path*
+snapshot_game_path(const struct game* game, uint32_t i)
+{
+  return i < game->trolls.count ? game->trolls.path[i] : game->player->path;
+}
+
+// Compute where each section of (game) goes in the file
+static struct snapshot_header
+snapshot_layout(const struct game* game)
+{
+  const struct maze* maze = &game->maze;
+  const struct trolls* trolls = &game->trolls;
+  const uint64_t cells = (uint64_t)maze->maze_width * maze->maze_height;
+  const uint64_t size = maze_size(maze);
+
+  struct snapshot_header header = {
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+    .seed = game->seed,
+    .tick = game->tick,
+    .state = game->state,
+    .player_vision = game->player_vision,
+    .player_x = game->player->loc.x,
+    .player_y = game->player->loc.y,
+    .player_face = game->player->face,
+    .budget = game->schedule.budget,
+    .order = game->schedule.order,
+    .lod_radius = game->schedule.lod_radius,
+    .lod_period = game->schedule.lod_period,
+    .width = maze->maze_width,
+    .height = maze->maze_height,
+    .num_exits = maze->num_exits,
+    .generation = maze->generation,
+    .num_trolls = trolls->count,
+    .num_handles = trolls->num_handles,
+  };
+
+  for (uint32_t i = 0; i <= trolls->count; i++) {
+    const struct path* path = snapshot_game_path(game, i);
+    if (path)
+      header.num_steps += path->num_steps;
+  }
+
+  if (maze->layout == MAZE_TILED)
+    header.flags |= SNAPSHOT_TILED;
+
+  header.cells_offset = snapshot_align(sizeof(header), SNAPSHOT_PAGE);
+  uint64_t end = header.cells_offset + size;
+
+  if (maze->rays) {
+    header.flags |= SNAPSHOT_RAYS;
+    header.rays_offset = snapshot_align(end, 8);
+    end = header.rays_offset + 4 * size * sizeof(*maze->rays);
+  }
+
+  if (maze->components) {
+    header.flags |= SNAPSHOT_COMPONENTS;
+    header.components_offset = snapshot_align(end, 8);
+    end = header.components_offset + cells * sizeof(*maze->components);
+  }
+
+  header.exits_offset = snapshot_align(end, 8);
+  end = header.exits_offset + (uint64_t)maze->num_exits * sizeof(uint32_t);
+
+  if (maze->journal) {
+    header.flags |= SNAPSHOT_JOURNAL;
+    header.journal_offset = snapshot_align(end, 8);
+    end = header.journal_offset +
+          MAZE_JOURNAL_LENGTH * sizeof(struct maze_change);
+  }
+
+  header.trolls_offset = snapshot_align(end, 8);
+  end = header.trolls_offset + trolls->num_handles * SNAPSHOT_TROLL_SIZE;
+
+  header.paths_offset = snapshot_align(end, 8);
+  end = header.paths_offset +
+        ((uint64_t)trolls->count + 1) * sizeof(struct snapshot_path);
+
+  header.steps_offset = snapshot_align(end, 8);
+  header.size =
+    header.steps_offset + header.num_steps * sizeof(enum direction);
+
+  return header;
+}
+
+// Write (len) bytes of (data) at (offset), zero filling any gap
+static int
+snapshot_write(FILE* file, uint64_t* pos, uint64_t offset, const void* data,
+               size_t len)
+{
+  for (; *pos < offset; (*pos)++)
+    if (fputc(0, file) == EOF)
+      return 0;
+
+  if (len && fwrite(data, 1, len, file) != len)
+    return 0;
+
+  *pos += len;
+  return 1;
+}
+
+static int
+snapshot_write_paths(FILE* file, uint64_t* pos,
+                     const struct snapshot_header* header,
+                     const struct game* game)
+{
+  uint64_t first = 0;
+
+  for (uint32_t i = 0; i <= header->num_trolls; i++) {
+    const struct path* path = snapshot_game_path(game, i);
+    struct snapshot_path record = {.first = SNAPSHOT_NO_PATH };
+
+    if (path) {
+      record = (struct snapshot_path){.next = path->next,
+                                      .num_steps = path->num_steps,
+                                      .first = first };
+      first += path->num_steps;
+    }
+
+    const uint64_t offset = header->paths_offset + i * sizeof(record);
+    if (!snapshot_write(file, pos, offset, &record, sizeof(record)))
+      return 0;
+  }
+
+  for (uint32_t i = 0; i <= header->num_trolls; i++) {
+    const struct path* path = snapshot_game_path(game, i);
+    if (path && !snapshot_write(file, pos, header->steps_offset, path->steps,
+                                path->num_steps * sizeof(*path->steps)))
+      return 0;
+  }
+
+  return snapshot_write(file, pos, header->size, NULL, 0);
+}
+
+// Save the whole state of (game) to (path)
+// Returns 1 on success, 0 on failure or for games on a paged maze, which
+// cannot be snapshotted
+int
+game_snapshot_save(const struct game* game, const char* path)
+{
+  const struct maze* maze = &game->maze;
+  const struct trolls* trolls = &game->trolls;
+  const struct snapshot_header header = snapshot_layout(game);
+  const size_t cells = (size_t)maze->maze_width * maze->maze_height;
+  const size_t size = maze_size(maze);
+  const size_t handles = trolls->num_handles;
+
+  if (maze->pager)
+    return 0;
+
+  FILE* file = fopen(path, "wb");
+  if (!file)
+    return 0;
+
+  uint64_t pos = 0;
+  int ok =
+    snapshot_write(file, &pos, 0, &header, sizeof(header)) &&
+    snapshot_write(file, &pos, header.cells_offset, maze->maze, size);
+
+  if (ok && maze->rays)
+    ok = snapshot_write(file, &pos, header.rays_offset, maze->rays,
+                        4 * size * sizeof(*maze->rays));
+
+  if (ok && maze->components)
+    ok = snapshot_write(file, &pos, header.components_offset,
+                        maze->components, cells * sizeof(*maze->components));
+
+  ok = ok && snapshot_write(file, &pos, header.exits_offset, maze->exits,
+                            maze->num_exits * sizeof(*maze->exits));
+
+  if (ok && maze->journal)
+    ok = snapshot_write(file, &pos, header.journal_offset, maze->journal,
+                        MAZE_JOURNAL_LENGTH * sizeof(*maze->journal));
+
+  ok = ok &&
+       snapshot_write(file, &pos, header.trolls_offset, trolls->loc,
+                      handles * sizeof(*trolls->loc)) &&
+       snapshot_write(file, &pos, pos, trolls->face,
+                      handles * sizeof(*trolls->face)) &&
+       snapshot_write(file, &pos, pos, trolls->handle,
+                      handles * sizeof(*trolls->handle)) &&
+       snapshot_write(file, &pos, pos, trolls->index,
+                      handles * sizeof(*trolls->index)) &&
+       snapshot_write_paths(file, &pos, &header, game);
+
+  if (fclose(file) != 0)
+    ok = 0;
+
+  return ok;
+}
+
+// Returns true if the section of (len) bytes at (offset) is in the file and
+// aligned to (align)
+static bool
+snapshot_section(const struct snapshot_header* header, uint64_t offset,
+                 uint64_t len, uint64_t align)
+{
+  return offset % align == 0 && offset >= sizeof(*header) &&
+         offset <= header->size && len <= header->size - offset;
+}
+
+// Make sure the header describes a file we can use in place
+static bool
+snapshot_valid(const struct snapshot_header* header, uint64_t size)
+{
+  const uint64_t cells = (uint64_t)header->width * header->height;
+  const struct maze shape = {
+    .maze_width = header->width,
+    .maze_height = header->height,
+    .layout = header->flags & SNAPSHOT_TILED ? MAZE_TILED : MAZE_LINEAR,
+  };
+
+  if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION)
+    return false;
+
+  if (header->size != size || !cells || header->width > MAZE_MAX_SIDE ||
+      header->height > MAZE_MAX_SIDE)
+    return false;
+
+  if (header->state > GAME_LOSE || header->player_face > WEST ||
+      header->player_vision > UINT8_MAX || header->player_x >= header->width ||
+      header->player_y >= header->height ||
+      header->order > TROLLS_NEAREST_FIRST)
+    return false;
+
+  if (header->num_trolls > header->num_handles ||
+      header->num_trolls == UINT32_MAX || header->num_steps > size)
+    return false;
+
+  const uint64_t maze_bytes = maze_size(&shape);
+
+  return header->cells_offset % SNAPSHOT_PAGE == 0 &&
+         snapshot_section(header, header->cells_offset, maze_bytes, 1) &&
+         (!(header->flags & SNAPSHOT_RAYS) ||
+          snapshot_section(header, header->rays_offset,
+                           4 * maze_bytes * sizeof(uint16_t), 8)) &&
+         (!(header->flags & SNAPSHOT_COMPONENTS) ||
+          snapshot_section(header, header->components_offset,
+                           cells * sizeof(uint32_t), 8)) &&
+         snapshot_section(header, header->exits_offset,
+                          header->num_exits * sizeof(uint32_t), 8) &&
+         (!(header->flags & SNAPSHOT_JOURNAL) ||
+          snapshot_section(header, header->journal_offset,
+                           MAZE_JOURNAL_LENGTH * sizeof(struct maze_change),
+                           8)) &&
+         snapshot_section(header, header->trolls_offset,
+                          header->num_handles * SNAPSHOT_TROLL_SIZE, 8) &&
+         snapshot_section(header, header->paths_offset,
+                          ((uint64_t)header->num_trolls + 1) *
+                            sizeof(struct snapshot_path),
+                          8) &&
+         snapshot_section(header, header->steps_offset,
+                          header->num_steps * sizeof(enum direction), 8);
+}
+
+// Copy (len) bytes at (offset) of the mapping (base) into an allocation
+static void*
+snapshot_copy(const char* base, uint64_t offset, size_t len)
+{
+  void* copy = malloc(len ? len : 1);
+  if (!copy)
+    exit(1);
+
+  memcpy(copy, base + offset, len);
+  return copy;
+}
+
+// Copy the path (record) out of the steps at (steps)
+// Returns false if the path is not within the snapshot
+static bool
+snapshot_load_path(const struct snapshot_header* header,
+                   const enum direction* steps,
+                   const struct snapshot_path* record, struct path** pathp)
+{
+  *pathp = NULL;
+  if (record->first == SNAPSHOT_NO_PATH)
+    return true;
+
+  if (record->first > header->num_steps ||
+      record->num_steps > header->num_steps - record->first ||
+      record->next > record->num_steps)
+    return false;
+
+  struct path* path = path_new(record->num_steps);
+  path->next = record->next;
+  if (record->num_steps)
+    memcpy(path->steps, steps + record->first,
+           record->num_steps * sizeof(*path->steps));
+
+  *pathp = path;
+  return true;
+}
+
+// Set up the trolls of (game) from the snapshot mapped at (base)
+// Returns false if they do not make sense for the maze
+static bool
+snapshot_load_trolls(struct game* game, const struct snapshot_header* header,
+                     const char* base)
+{
+  struct trolls* trolls = &game->trolls;
+  const uint32_t handles = header->num_handles;
+
+  trolls_init(trolls, &game->maze);
+  trolls->capacity = handles;
+  trolls->num_handles = handles;
+
+  uint64_t offset = header->trolls_offset;
+  trolls->loc = snapshot_copy(base, offset, handles * sizeof(*trolls->loc));
+  offset += handles * sizeof(*trolls->loc);
+  trolls->face = snapshot_copy(base, offset, handles * sizeof(*trolls->face));
+  offset += handles * sizeof(*trolls->face);
+  trolls->handle =
+    snapshot_copy(base, offset, handles * sizeof(*trolls->handle));
+  offset += handles * sizeof(*trolls->handle);
+  trolls->index = snapshot_copy(base, offset, handles * sizeof(*trolls->index));
+
+  trolls->path = calloc(handles ? handles : 1, sizeof(*trolls->path));
+  if (!trolls->path)
+    exit(1);
+
+  const struct snapshot_path* records =
+    (const struct snapshot_path*)(const void*)(base + header->paths_offset);
+  const enum direction* steps =
+    (const enum direction*)(const void*)(base + header->steps_offset);
+
+  // The handles must be a permutation, with (index) its inverse: two slots
+  // with one handle would have trolls_remove() and trolls_index() mix the
+  // trolls up. trolls_add() gives out the handles past (count) again, so this
+  // goes for all of them.
+  bool* seen = calloc(handles ? handles : 1, sizeof(*seen));
+  if (!seen)
+    exit(1);
+
+  bool permutation = true;
+  for (uint32_t i = 0; i < handles && permutation; i++) {
+    const uint32_t handle = trolls->handle[i];
+    permutation =
+      handle < handles && !seen[handle] && trolls->index[handle] == i;
+    if (permutation)
+      seen[handle] = true;
+  }
+  free(seen);
+
+  if (!permutation)
+    return false;
+
+  // Count the trolls in one by one so that trolls_destroy() frees exactly
+  // what was loaded should one of them be broken
+  for (uint32_t i = 0; i < header->num_trolls; i++) {
+    if (!maze_check_bound_loc(&game->maze, trolls->loc[i]) ||
+        trolls->face[i] > WEST)
+      return false;
+
+    if (!snapshot_load_path(header, steps, &records[i], &trolls->path[i]))
+      return false;
+
+    trolls->count++;
+    occupancy_add(&trolls->occupancy, trolls->loc[i]);
+  }
+
+  return snapshot_load_path(header, steps, &records[header->num_trolls],
+                            &game->player->path);
+}
+
+// Load a game saved with game_snapshot_save() from (path)
+// The game has no threads to plan paths on, see game_set_threads().
+//
+// Returns NULL if the file cannot be mapped or is not a valid snapshot
+struct game*
+game_snapshot_load(const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  struct snapshot_header header;
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      !snapshot_valid(&header, (uint64_t)st.st_size)) {
+    close(fd);
+    return NULL;
+  }
+
+  // Private, so the game can change the maze without touching the file
+  char* base = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED)
+    return NULL;
+
+  // The exits are checked like those of binary mazes, before a game is made
+  const uint32_t* exits = (const uint32_t*)(void*)(base + header.exits_offset);
+  if (!maze_exits_valid(header.width, header.height, exits,
+                        header.num_exits)) {
+#ifdef DEBUG
+    fprintf(stderr, "snapshot_load: %s: invalid exits\n", path);
+#endif
+    munmap(base, header.size);
+    return NULL;
+  }
+
+  struct game* game = calloc(1, sizeof(*game));
+  if (!game)
+    exit(1);
+
+  game->seed = header.seed;
+  rng_seed(&game->rng, game->seed);
+  game->tick = header.tick;
+  game->state = (enum game_state)header.state;
+  game->player_vision = (uint8_t)header.player_vision;
+  game->schedule.budget = header.budget;
+  game->schedule.order = (enum trolls_order)header.order;
+  game->schedule.lod_radius = header.lod_radius;
+  game->schedule.lod_period = header.lod_period;
+
+  // The maze owns the mapping from here on, maze_destroy() unmaps it
+  struct maze* maze = &game->maze;
+  *maze = (struct maze){
+    .maze = base + header.cells_offset,
+    .maze_width = header.width,
+    .maze_height = header.height,
+    .num_exits = header.num_exits,
+    .generation = header.generation,
+    .mapping = base,
+    .mapping_len = header.size,
+  };
+
+  if (header.flags & SNAPSHOT_RAYS)
+    maze->rays = (uint16_t*)(void*)(base + header.rays_offset);
+
+  if (header.flags & SNAPSHOT_COMPONENTS)
+    maze->components = (uint32_t*)(void*)(base + header.components_offset);
+
+  if (header.num_exits)
+    maze->exits = snapshot_copy(base, header.exits_offset,
+                                header.num_exits * sizeof(*maze->exits));
+
+  if (header.flags & SNAPSHOT_JOURNAL)
+    maze->journal =
+      snapshot_copy(base, header.journal_offset,
+                    MAZE_JOURNAL_LENGTH * sizeof(*maze->journal));
+
+  if (header.flags & SNAPSHOT_TILED)
+    maze_init_layout(maze, MAZE_TILED);
+
+  game->player = entity_new();
+  game->player->loc =
+    (struct location){.x = header.player_x, .y = header.player_y };
+  game->player->face = (enum direction)header.player_face;
+
+  fov_init(&game->vision, game->player_vision);
+
+  if (!snapshot_load_trolls(game, &header, base)) {
+#ifdef DEBUG
+    fprintf(stderr, "snapshot_load: %s: invalid troll\n", path);
+#endif
+    game_delete(game);
+    return NULL;
+  }
+
+  return game;
+}
@@ -1,9 +1,150 @@
 #include "troll.h"
 #include "game.h"
+#include "path.h"
+
+#include <string.h>
+
+/* Trolls are stored as a structure of arrays: the i-th troll is at loc[i],
+ * facing face[i], following path[i]. Updating or drawing them all is a linear
+ * sweep over arrays that only hold what that sweep needs.
+ *
+ * Removing a troll moves the last one into its slot, so the arrays stay
+ * dense and indexes change. Handles stay the same for the life of a troll:
+ * index[handle] is where the troll currently is, and handle[i] the handle of
+ * the troll at i. Past (count), handle[] holds the handles of removed trolls,
+ * which are given out again by trolls_add().
+ *
+ * trolls->occupancy counts the trolls on each cell, it is kept up to date by
+ * entity_move() as they walk around.
+ */
+
+void
+trolls_init(struct trolls* trolls, const struct maze* maze)
+{
+  *trolls = (struct trolls){ 0 };
+  occupancy_init(&trolls->occupancy, maze);
+}
+
+void
+trolls_destroy(struct trolls* trolls)
+{
+  for (uint32_t i = 0; i < trolls->count; i++)
+    path_delete(trolls->path[i]);
+
+  free(trolls->loc);
+  free(trolls->face);
+  free(trolls->path);
+  free(trolls->handle);
+  free(trolls->index);
+  free(trolls->plan_which);
+  free(trolls->plan_targets);
+  free(trolls->plan_paths);
+  free(trolls->plan_keys);
+  for (uint32_t k = 0; k < trolls->wheel.num_slots; k++)
+    free(trolls->wheel.slots[k].which);
+  free(trolls->wheel.slots);
+  free(trolls->wheel.awake.which);
+  occupancy_destroy(&trolls->occupancy);
+
+  *trolls = (struct trolls){ 0 };
+}
+
+// Resize (array) to (n) elements of (size) bytes
+static void*
+trolls_grow(void* array, uint32_t n, size_t size)
+{
+  void* grown = realloc(array, (size_t)n * size);
+  if (!grown)
+    exit(1);
+
+  return grown;
+}
+
+uint32_t
+trolls_add(struct trolls* trolls, struct location loc)
+{
+  if (trolls->count == trolls->capacity) {
+    const uint32_t capacity = trolls->capacity ? trolls->capacity * 2 : 16;
+
+    trolls->loc = trolls_grow(trolls->loc, capacity, sizeof(*trolls->loc));
+    trolls->face = trolls_grow(trolls->face, capacity, sizeof(*trolls->face));
+    trolls->path = trolls_grow(trolls->path, capacity, sizeof(*trolls->path));
+    trolls->handle =
+      trolls_grow(trolls->handle, capacity, sizeof(*trolls->handle));
+    trolls->index =
+      trolls_grow(trolls->index, capacity, sizeof(*trolls->index));
+    trolls->capacity = capacity;
+  }
+
+  const uint32_t i = trolls->count++;
+
+  // Reuse the handle of a removed troll if there is one
+  if (i == trolls->num_handles)
+    trolls->handle[trolls->num_handles++] = i;
+
+  trolls->loc[i] = loc;
+  trolls->face[i] = NORTH;
+  trolls->path[i] = NULL;
+  trolls->index[trolls->handle[i]] = i;
+  occupancy_add(&trolls->occupancy, loc);
+  trolls->wheel.valid = false;
+
+  return trolls->handle[i];
+}
 
-// Troll AI/movement function
 void
-trolls_update(const struct maze* maze, struct entity* troll)
+trolls_clear(struct trolls* trolls)
+{
+  for (uint32_t i = 0; i < trolls->count; i++) {
+    path_delete(trolls->path[i]);
+    occupancy_remove(&trolls->occupancy, trolls->loc[i]);
+  }
+
+  trolls->count = 0;
+  trolls->num_handles = 0;
+  trolls->wheel.valid = false;
+}
+
+uint32_t
+trolls_index(const struct trolls* trolls, uint32_t handle)
+{
+  if (handle >= trolls->num_handles)
+    return TROLL_NONE;
+
+  const uint32_t i = trolls->index[handle];
+  if (i >= trolls->count || trolls->handle[i] != handle)
+    return TROLL_NONE;
+
+  return i;
+}
+
+bool
+trolls_remove(struct trolls* trolls, uint32_t handle)
+{
+  const uint32_t i = trolls_index(trolls, handle);
+  if (i == TROLL_NONE)
+    return false;
+
+  path_delete(trolls->path[i]);
+  occupancy_remove(&trolls->occupancy, trolls->loc[i]);
+
+  // Move the last troll into the hole, and the removed handle past the end
+  const uint32_t last = --trolls->count;
+  trolls->loc[i] = trolls->loc[last];
+  trolls->face[i] = trolls->face[last];
+  trolls->path[i] = trolls->path[last];
+  trolls->handle[i] = trolls->handle[last];
+  trolls->handle[last] = handle;
+  trolls->index[trolls->handle[i]] = i;
+  trolls->index[handle] = last;
+  trolls->wheel.valid = false;
+
+  return true;
+}
+
+// Troll AI/movement function
+static void
+troll_update(const struct maze* maze, struct rng* rng, struct entity* troll)
 {
   // Check if we already have a defined path and follow it
   if (entity_follow_path(maze, troll))
@@ -12,7 +153,7 @@ trolls_update(const struct maze* maze, struct entity* troll)
   // Else
   // If we've failed to follow the path for any reason, try to calculate the
   // new path to a random empty location on the maze
-  if (entity_new_path(maze, troll, maze_find_empty_location(maze)))
+  if (entity_new_path(maze, troll, maze_find_empty_location(maze, rng)))
     return;
 
   // Else
@@ -20,3 +161,379 @@ trolls_update(const struct maze* maze, struct entity* troll)
   // This only fails if we can't continue moving the direction we're facing
   entity_move(maze, troll, troll->face);
 }
+
+void
+trolls_update(const struct maze* maze, struct trolls* trolls, struct rng* rng,
+              uint32_t i)
+{
+  // The entity functions work on a single entity, gather the troll into one
+  // and scatter it back when done
+  struct entity troll = {.face = trolls->face[i],
+                         .loc = trolls->loc[i],
+                         .path = trolls->path[i],
+                         .occupancy = &trolls->occupancy };
+
+  troll_update(maze, rng, &troll);
+
+  trolls->face[i] = troll.face;
+  trolls->loc[i] = troll.loc;
+  trolls->path[i] = troll.path;
+}
+
+/* A tick of all the trolls is split in four phases:
+ *  - decide, serially: each troll follows its path if it can, otherwise it
+ *    asks for a new one
+ *  - schedule, serially: up to schedule->budget of the trolls asking are
+ *    served, each picks a new random target
+ *  - plan, in parallel: the paths to the new targets are found
+ *  - commit, serially: the trolls that got a path take it, the others move on
+ *    the way they face
+ *
+ * Only the schedule phase draws random numbers and only the commit phase moves
+ * trolls, and path_find() only reads the maze. So a tick plays out the same
+ * whatever the number of threads. Without a budget every troll asking is
+ * served in index order, which is exactly what trolls_update() on each troll
+ * in turn does.
+ *
+ * With a budget, the trolls left waiting keep asking until they are served.
+ * TROLLS_ROUND_ROBIN serves them in index order from a point that moves on by
+ * (budget) every tick, so none of them waits much longer than count / budget
+ * ticks. TROLLS_NEAREST_FIRST serves the ones closest to schedule->focus
+ * first, those are the ones the player sees.
+ */
+struct trolls_plan
+{
+  const struct maze* maze;
+  const struct trolls* trolls;
+  uint32_t* which;          // index of each troll that needs a path, the
+                            // ones served first
+  struct location* targets; // the target of each troll served
+  struct path** paths;      // the path found, NULL if none
+};
+
+static int
+trolls_compare_keys(const void* a, const void* b)
+{
+  const uint64_t ka = *(const uint64_t*)a;
+  const uint64_t kb = *(const uint64_t*)b;
+
+  return (ka > kb) - (ka < kb);
+}
+
+// Move the (num_served) trolls of (which) that (schedule) serves first to the
+// front of it, of the (num_waiting) there are
+static void
+trolls_schedule(const struct trolls* trolls,
+                const struct trolls_schedule* schedule, uint32_t* which,
+                uint32_t num_waiting, uint32_t num_served)
+{
+  if (num_served == num_waiting)
+    return;
+
+  if (schedule->order == TROLLS_ROUND_ROBIN) {
+    // (which) is in index order: rotate it to start at the first troll from
+    // (start) on
+    const uint32_t start =
+      (uint32_t)(schedule->tick * schedule->budget % trolls->count);
+
+    uint32_t first = 0;
+    while (first < num_waiting && which[first] < start)
+      first++;
+
+    uint32_t* rotated = (uint32_t*)(void*)trolls->plan_keys;
+    for (uint32_t k = 0; k < num_waiting; k++)
+      rotated[k] = which[(first + k) % num_waiting];
+    memcpy(which, rotated, num_waiting * sizeof(*which));
+    return;
+  }
+
+  // Sort by distance to the focus, then by index
+  uint64_t* keys = trolls->plan_keys;
+  for (uint32_t k = 0; k < num_waiting; k++) {
+    const struct location loc = trolls->loc[which[k]];
+    const uint64_t dx = loc.x > schedule->focus.x ? loc.x - schedule->focus.x
+                                                  : schedule->focus.x - loc.x;
+    const uint64_t dy = loc.y > schedule->focus.y ? loc.y - schedule->focus.y
+                                                  : schedule->focus.y - loc.y;
+    keys[k] = (dx + dy) << 32 | which[k];
+  }
+
+  qsort(keys, num_waiting, sizeof(*keys), trolls_compare_keys);
+
+  for (uint32_t k = 0; k < num_waiting; k++)
+    which[k] = (uint32_t)keys[k];
+}
+
+// Returns the larger of the distances between (a) and (b) in x and in y
+static uint32_t
+trolls_distance(struct location a, struct location b)
+{
+  const uint32_t dx = a.x > b.x ? a.x - b.x : b.x - a.x;
+  const uint32_t dy = a.y > b.y ? a.y - b.y : b.y - a.y;
+
+  return dx > dy ? dx : dy;
+}
+
+// Whether the troll (i) is far enough from the focus to be simulated coarsely
+static bool
+trolls_far(const struct trolls* trolls, const struct trolls_schedule* schedule,
+           uint32_t i)
+{
+  if (!schedule || schedule->lod_period <= 1)
+    return false;
+
+  return trolls_distance(trolls->loc[i], schedule->focus) >
+         schedule->lod_radius;
+}
+
+// Returns the number of steps the troll (i) takes this tick
+// A far troll sits out (lod_period - 1) ticks, and then makes up for them.
+// Which tick is its own depends on its handle, so that the far trolls do not
+// all move on the same tick.
+static uint32_t
+trolls_lod_steps(const struct trolls* trolls,
+                 const struct trolls_schedule* schedule, uint32_t i)
+{
+  if (!trolls_far(trolls, schedule, i))
+    return 1;
+
+  if ((schedule->tick + trolls->handle[i]) % schedule->lod_period)
+    return 0;
+
+  return schedule->lod_period;
+}
+
+static void
+trolls_slot_push(struct trolls_slot* slot, uint32_t i)
+{
+  if (slot->count == slot->capacity) {
+    slot->capacity = slot->capacity ? slot->capacity * 2 : 16;
+    slot->which =
+      trolls_grow(slot->which, slot->capacity, sizeof(*slot->which));
+
+    pool_count_system(POOL_SCRATCH);
+  }
+
+  slot->which[slot->count++] = i;
+}
+
+static int
+trolls_compare_indexes(const void* a, const void* b)
+{
+  const uint32_t ia = *(const uint32_t*)a;
+  const uint32_t ib = *(const uint32_t*)b;
+
+  return (ia > ib) - (ia < ib);
+}
+
+// Whether the trolls asleep in (wheel) can sleep on at (schedule)->tick
+// A far troll sleeps until the player could have come near it at the soonest,
+// which only holds if the player went one step a tick from where the wheel
+// last saw them, and the trolls and the schedule are the same as then.
+static bool
+trolls_wheel_valid(const struct trolls_wheel* wheel,
+                   const struct trolls_schedule* schedule)
+{
+  return wheel->valid && wheel->tick + 1 == schedule->tick &&
+         trolls_distance(wheel->focus, schedule->focus) <= 1 &&
+         wheel->lod_radius == schedule->lod_radius &&
+         wheel->lod_period == schedule->lod_period;
+}
+
+// List the trolls to update this tick in (trolls)->wheel.awake, in index
+// order: the ones that were awake and the ones waking up
+static void
+trolls_wake(struct trolls* trolls, const struct trolls_schedule* schedule)
+{
+  struct trolls_wheel* wheel = &trolls->wheel;
+
+  if (trolls_wheel_valid(wheel, schedule)) {
+    struct trolls_slot* slot =
+      &wheel->slots[schedule->tick & (wheel->num_slots - 1)];
+
+    for (uint32_t k = 0; k < slot->count; k++)
+      trolls_slot_push(&wheel->awake, slot->which[k]);
+    slot->count = 0;
+
+    qsort(wheel->awake.which, wheel->awake.count, sizeof(*wheel->awake.which),
+          trolls_compare_indexes);
+  } else {
+    // Wake everyone
+    uint32_t num_slots = 2;
+    while (num_slots <= schedule->lod_period)
+      num_slots *= 2;
+
+    if (num_slots > wheel->num_slots) {
+      wheel->slots =
+        trolls_grow(wheel->slots, num_slots, sizeof(*wheel->slots));
+      for (uint32_t k = wheel->num_slots; k < num_slots; k++)
+        wheel->slots[k] = (struct trolls_slot){ 0 };
+      wheel->num_slots = num_slots;
+
+      pool_count_system(POOL_SCRATCH);
+    }
+
+    for (uint32_t k = 0; k < wheel->num_slots; k++)
+      wheel->slots[k].count = 0;
+
+    wheel->awake.count = 0;
+    for (uint32_t i = 0; i < trolls->count; i++)
+      trolls_slot_push(&wheel->awake, i);
+
+    wheel->valid = true;
+  }
+
+  wheel->tick = schedule->tick;
+  wheel->focus = schedule->focus;
+  wheel->lod_radius = schedule->lod_radius;
+  wheel->lod_period = schedule->lod_period;
+}
+
+// Put the far trolls that were updated this tick to sleep
+// A far troll has nothing to do until its next tick of its own (see
+// trolls_lod_steps()), unless the player comes near before that. The player
+// goes one step a tick, so that cannot happen for as many ticks as the troll
+// is further than lod_radius.
+static void
+trolls_sleep(struct trolls* trolls, const struct trolls_schedule* schedule)
+{
+  struct trolls_wheel* wheel = &trolls->wheel;
+  const uint64_t tick = schedule->tick;
+  const uint32_t period = schedule->lod_period;
+  uint32_t num_awake = 0;
+
+  for (uint32_t k = 0; k < wheel->awake.count; k++) {
+    const uint32_t i = wheel->awake.which[k];
+    const uint32_t distance = trolls_distance(trolls->loc[i], schedule->focus);
+
+    uint64_t wake = tick + 1;
+    if (distance > schedule->lod_radius) {
+      wake = tick + period - (tick + trolls->handle[i]) % period;
+      if (wake > tick + distance - schedule->lod_radius)
+        wake = tick + distance - schedule->lod_radius;
+    }
+
+    if (wake == tick + 1)
+      wheel->awake.which[num_awake++] = i;
+    else
+      trolls_slot_push(&wheel->slots[wake & (wheel->num_slots - 1)], i);
+  }
+
+  wheel->awake.count = num_awake;
+}
+
+static void
+trolls_plan_paths(void* ctx, size_t begin, size_t end)
+{
+  struct trolls_plan* plan = ctx;
+
+  for (size_t k = begin; k < end; k++)
+    plan->paths[k] = path_find(plan->maze, plan->trolls->loc[plan->which[k]],
+                               plan->targets[k]);
+}
+
+void
+trolls_update_all(const struct maze* maze, struct trolls* trolls,
+                  struct rng* rng, struct job_pool* jobs,
+                  const struct trolls_schedule* schedule)
+{
+  // Every troll may need a path
+  if (trolls->plan_capacity < trolls->count) {
+    const uint32_t capacity = trolls->capacity;
+
+    trolls->plan_which =
+      trolls_grow(trolls->plan_which, capacity, sizeof(*trolls->plan_which));
+    trolls->plan_targets = trolls_grow(trolls->plan_targets, capacity,
+                                       sizeof(*trolls->plan_targets));
+    trolls->plan_paths =
+      trolls_grow(trolls->plan_paths, capacity, sizeof(*trolls->plan_paths));
+    trolls->plan_keys =
+      trolls_grow(trolls->plan_keys, capacity, sizeof(*trolls->plan_keys));
+    trolls->plan_capacity = capacity;
+
+    pool_count_system(POOL_SCRATCH);
+  }
+
+  struct trolls_plan plan = {
+    .maze = maze,
+    .trolls = trolls,
+    .which = trolls->plan_which,
+    .targets = trolls->plan_targets,
+    .paths = trolls->plan_paths,
+  };
+
+  // Only the trolls that are awake need a look, see trolls_sleep()
+  const bool lod = schedule && schedule->lod_period > 1;
+  if (lod)
+    trolls_wake(trolls, schedule);
+
+  const uint32_t* awake = lod ? trolls->wheel.awake.which : NULL;
+  const uint32_t num_awake = lod ? trolls->wheel.awake.count : trolls->count;
+
+  // Decide
+  uint32_t num_waiting = 0;
+  for (uint32_t n = 0; n < num_awake; n++) {
+    const uint32_t i = awake ? awake[n] : n;
+    const uint32_t num_steps = trolls_lod_steps(trolls, schedule, i);
+    if (!num_steps)
+      continue;
+
+    struct entity troll = {.face = trolls->face[i],
+                           .loc = trolls->loc[i],
+                           .path = trolls->path[i],
+                           .occupancy = &trolls->occupancy };
+
+    for (uint32_t step = 0; step < num_steps; step++) {
+      if (!entity_follow_path(maze, &troll)) {
+        plan.which[num_waiting++] = i;
+        break;
+      }
+    }
+
+    trolls->face[i] = troll.face;
+    trolls->loc[i] = troll.loc;
+    trolls->path[i] = troll.path;
+  }
+
+  // Schedule
+  uint32_t num_plans = num_waiting;
+  if (schedule && schedule->budget && schedule->budget < num_waiting)
+    num_plans = schedule->budget;
+
+  if (schedule)
+    trolls_schedule(trolls, schedule, plan.which, num_waiting, num_plans);
+
+  // Nobody sees where a far troll goes: it wanders about where it is, which
+  // takes a much smaller search than crossing the maze
+  for (uint32_t k = 0; k < num_plans; k++) {
+    const uint32_t i = plan.which[k];
+
+    if (trolls_far(trolls, schedule, i))
+      plan.targets[k] = maze_find_empty_location_near(
+        maze, rng, trolls->loc[i], schedule->lod_radius);
+    else
+      plan.targets[k] = maze_find_empty_location(maze, rng);
+  }
+
+  // Plan
+  job_pool_for(jobs, num_plans, 1, trolls_plan_paths, &plan);
+
+  // Commit
+  for (uint32_t k = 0; k < num_waiting; k++) {
+    const uint32_t i = plan.which[k];
+
+    if (k < num_plans && plan.paths[k]) {
+      trolls->path[i] = plan.paths[k];
+      continue;
+    }
+
+    struct entity troll = {.face = trolls->face[i],
+                           .loc = trolls->loc[i],
+                           .occupancy = &trolls->occupancy };
+    entity_move(maze, &troll, troll.face);
+    trolls->loc[i] = troll.loc;
+  }
+
+  if (lod)
+    trolls_sleep(trolls, schedule);
+}
@@ -0,0 +1,117 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "game.h" // for maze, entity, maze_set_layout, maze_build_rays
+#include "path.h" // for path_find
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/maze-gen.c"
+
+// Compare the throughput of path_find() and entity_look() with the cells of
+// a large maze stored row-major and tiled, and of entity_look() with the wall
+// distance tables.
+
+static const uint32_t MAZE_SIZE = 4096;
+static const size_t NUM_PATHS = 8;
+static const size_t NUM_LOOKS = 4000000;
+
+int main(int argc, char* argv[]);
+
+// Uniformly pick an empty cell, the maze is about half empty
+static struct location
+random_empty(const struct maze* maze)
+{
+  struct location loc;
+  do {
+    loc.x = (uint32_t)rand() % maze->maze_width;
+    loc.y = (uint32_t)rand() % maze->maze_height;
+  } while (!maze_is_empty_space_loc(maze, loc));
+
+  return loc;
+}
+
+static double
+elapsed(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char* argv[])
+{
+  const uint32_t size = argc > 1 ? (uint32_t)atoi(argv[1]) : MAZE_SIZE;
+
+  struct maze maze;
+  srand(1);
+  maze_generate(&maze, size, size, 10);
+
+  // The same random queries are used for both layouts
+  struct location* ends = malloc(2 * NUM_PATHS * sizeof(*ends));
+  struct entity* lookers = malloc(NUM_LOOKS * sizeof(*lookers));
+  if (!ends || !lookers)
+    exit(1);
+
+  for (size_t i = 0; i < 2 * NUM_PATHS; i++)
+    ends[i] = random_empty(&maze);
+  for (size_t i = 0; i < NUM_LOOKS; i++)
+    lookers[i] = (struct entity){.loc = random_empty(&maze) };
+
+  const enum maze_layout layouts[] = { MAZE_LINEAR, MAZE_TILED };
+  const char* names[] = { "linear", "tiled" };
+
+  printf("%ux%u maze\n", size, size);
+
+  for (size_t l = 0; l < LEN(layouts); l++) {
+    maze_set_layout(&maze, layouts[l]);
+
+    struct timespec start;
+    size_t steps = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < NUM_PATHS; i++) {
+      struct path* path = path_find(&maze, ends[2 * i], ends[2 * i + 1]);
+      if (path) {
+        steps += path->num_steps;
+        path_delete(path);
+      }
+    }
+    const double path_time = elapsed(&start);
+
+    long seen = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < NUM_LOOKS; i++)
+      for (enum direction dir = NORTH; dir <= WEST; dir++)
+        seen += entity_look(&maze, &lookers[i], dir);
+    const double look_time = elapsed(&start);
+
+    printf("%-7s path_find: %8.2f paths/s (%zu steps)  "
+           "entity_look: %8.2f M looks/s (%ld cells)\n",
+           names[l], (double)NUM_PATHS / path_time, steps,
+           4.0 * (double)NUM_LOOKS / look_time / 1e6, seen);
+  }
+
+  // entity_look() with the wall distance tables, in the last layout
+  maze_build_rays(&maze);
+
+  long seen = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < NUM_LOOKS; i++)
+    for (enum direction dir = NORTH; dir <= WEST; dir++)
+      seen += entity_look(&maze, &lookers[i], dir);
+  const double look_time = elapsed(&start);
+
+  printf("%-7s entity_look: %8.2f M looks/s (%ld cells)\n", "rays",
+         4.0 * (double)NUM_LOOKS / look_time / 1e6, seen);
+
+  free(ends);
+  free(lookers);
+  maze_destroy(&maze);
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "game.h"  // for maze, entity, entity_move, occupancy_count
+#include "troll.h" // for trolls, trolls_add
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/maze-gen.c"
+
+// Collision and catch checks for 10k trolls wandering a maze, with the
+// occupancy counts against comparing every pair of trolls.
+// The first maze is small enough for the occupancy grid, the second one uses
+// the hash table.
+
+static const uint32_t NUM_TROLLS = 10000;
+static const size_t NUM_TICKS = 200;
+
+int main(void);
+
+static double
+elapsed(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+bench(uint32_t width, uint32_t height)
+{
+  struct maze maze;
+  maze_generate(&maze, width, height, 20);
+
+  struct rng rng;
+  rng_seed(&rng, 1);
+
+  struct trolls trolls;
+  trolls_init(&trolls, &maze);
+  for (uint32_t i = 0; i < NUM_TROLLS; i++)
+    trolls_add(&trolls, maze_find_empty_location(&maze, &rng));
+
+  const struct location player = maze_find_empty_location(&maze, &rng);
+
+  // Every troll takes a random step, then checks whether it bumped into
+  // another troll or caught the player
+  size_t collisions = 0, catches = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t tick = 0; tick < NUM_TICKS; tick++) {
+    for (uint32_t i = 0; i < trolls.count; i++) {
+      struct entity troll = {.face = trolls.face[i],
+                             .loc = trolls.loc[i],
+                             .occupancy = &trolls.occupancy };
+      entity_move(&maze, &troll, (enum direction)(rand() % 4));
+      trolls.face[i] = troll.face;
+      trolls.loc[i] = troll.loc;
+    }
+
+    for (uint32_t i = 0; i < trolls.count; i++)
+      collisions += occupancy_count(&trolls.occupancy, trolls.loc[i]) > 1;
+    catches += occupancy_count(&trolls.occupancy, player);
+  }
+  const double grid_time = elapsed(&start) / NUM_TICKS;
+
+  // The same checks for the last tick without the occupancy counts
+  size_t naive_collisions = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t i = 0; i < trolls.count; i++) {
+    for (uint32_t j = 0; j < trolls.count; j++) {
+      if (i != j && trolls.loc[i].x == trolls.loc[j].x &&
+          trolls.loc[i].y == trolls.loc[j].y) {
+        naive_collisions++;
+        break;
+      }
+    }
+  }
+  const double naive_time = elapsed(&start);
+
+  size_t last_collisions = 0;
+  for (uint32_t i = 0; i < trolls.count; i++)
+    last_collisions += occupancy_count(&trolls.occupancy, trolls.loc[i]) > 1;
+
+  printf("%ux%u maze (%s), %u trolls\n", width, height,
+         trolls.occupancy.grid ? "grid" : "hash", trolls.count);
+  printf("  occupancy: %8.3f ms/tick (%zu collisions, %zu catches)\n",
+         grid_time * 1e3, collisions, catches);
+  printf("  pairwise:  %8.3f ms/tick (%zu collisions, %s)\n",
+         naive_time * 1e3, naive_collisions,
+         naive_collisions == last_collisions ? "same" : "DIFFERENT");
+
+  trolls_destroy(&trolls);
+  maze_destroy(&maze);
+}
+
+int
+main(void)
+{
+  srand(1);
+
+  bench(1024, 1024);
+  bench(4096, 2048);
+
+  return 0;
+}
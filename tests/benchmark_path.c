@@ -1,5 +1,5 @@
 #include "game.h"   // for game, entity_move, direction::EAST, direction...
-#include "troll.h"  // for update_trolls
+#include "path.h"   // for path_delete
 
 #include <stdio.h>
 #include <stdint.h> // for int32_t
@@ -19,16 +19,15 @@ int main(void);
 int
 main(void)
 {
-  struct game* game = game_new();
+  struct game* game = game_new(NULL, 1);
 
   // Start at the bottom left of the default maze
-  game->trolls[0]->loc.x = 1;
-  game->trolls[0]->loc.y = 21;
+  struct entity troll = {.loc = {.x = 1, .y = 21 } };
 
   // Move to the top right of the maze(longest path)
   // Calculate the same path 10 000 times
   for (size_t count = 0; count < MAX_ITER; count++) {
-    entity_new_path(&game->maze, game->trolls[0],
+    entity_new_path(&game->maze, &troll,
         (struct location) { .x = 35, .y = 1 });
 
     if (count % 1000 == 0) {
@@ -39,6 +38,7 @@ main(void)
 
   puts("");
 
+  path_delete(troll.path);
   game_delete(game);
 
   return 0;
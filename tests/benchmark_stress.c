@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "game.h"  // for maze, entity, entity_move, maze_find_empty_location
+#include "path.h"  // for path_find
+#include "troll.h" // for trolls, trolls_update
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "src/maze-gen.c"
+
+// Stress the maze, entity and path modules on a maze too large for 8 or 16
+// bit coordinates and with more than 65535 open cells:
+//  - find the path between opposite corners and walk it, checking it ends
+//    next to the target
+//  - run a few trolls around the whole maze
+
+static const uint32_t MAZE_SIZE = 4096;
+static const size_t NUM_TROLLS = 16;
+static const size_t NUM_TICKS = 1000;
+
+int main(int argc, char* argv[]);
+
+static double
+elapsed(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char* argv[])
+{
+  const uint32_t size = argc > 1 ? (uint32_t)atoi(argv[1]) : MAZE_SIZE;
+
+  struct maze maze;
+  srand(1);
+  maze_generate(&maze, size, size, 0);
+
+  // The rooms in the opposite corners of the maze, see maze_generate()
+  const uint32_t last_room = 2 * ((size - 1) / 2) - 1;
+  const struct location source = {.x = 1, .y = 1 };
+  const struct location dest = {.x = last_room, .y = last_room };
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  struct path* path = path_find(&maze, source, dest);
+  const double path_time = elapsed(&start);
+
+  if (!path) {
+    printf("no path (%u, %u) -> (%u, %u)\n", source.x, source.y, dest.x,
+           dest.y);
+    return 1;
+  }
+
+  // Walk the path, turning before each move where needed
+  struct entity walker = {.loc = source, .face = NORTH };
+  for (; path->next < path->num_steps; path->next++)
+    while (entity_move(&maze, &walker, path->steps[path->next]) == 2)
+      ;
+
+  printf("%ux%u maze, path of %zu steps in %.3f s, ends at (%u, %u): %s\n",
+         size, size, path->num_steps, path_time, walker.loc.x, walker.loc.y,
+         location_adjacent(walker.loc, dest) ? "ok" : "WRONG");
+
+  path_delete(path);
+
+  // Trolls roaming the whole maze
+  struct rng rng;
+  rng_seed(&rng, 1);
+
+  struct trolls trolls;
+  trolls_init(&trolls, &maze);
+  for (size_t i = 0; i < NUM_TROLLS; i++)
+    trolls_add(&trolls, maze_find_empty_location(&maze, &rng));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t tick = 0; tick < NUM_TICKS; tick++)
+    for (uint32_t i = 0; i < trolls.count; i++)
+      trolls_update(&maze, &trolls, &rng, i);
+  const double tick_time = elapsed(&start);
+
+  printf("%zu trolls, %zu ticks: %.1f ticks/s\n", NUM_TROLLS, NUM_TICKS,
+         (double)NUM_TICKS / tick_time);
+
+  trolls_destroy(&trolls);
+  maze_destroy(&maze);
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include "game.h"
+#include <stdlib.h>
+
+/* Generate a random (width) x (height) maze for the benchmarks
+ *
+ * A perfect maze is carved out with a randomized depth first search over the
+ * cells at odd coordinates, then (loops) percent of the remaining walls
+ * between two of those cells are knocked out so most cells can be reached in
+ * more than one way, like the hand made mazes.
+ *
+ * The maze goes through maze_load() as text, like any other level.
+ */
+static void
+maze_generate(struct maze* maze, uint32_t width, uint32_t height, int loops)
+{
+  const size_t stride = (size_t)width + 1;
+  char* text = malloc(stride * height);
+  if (!text)
+    exit(1);
+
+  for (size_t y = 0; y < height; y++) {
+    for (size_t x = 0; x < width; x++)
+      text[stride * y + x] = '#';
+    text[stride * y + width] = '\n';
+  }
+
+  // Rooms are the cells at odd coordinates, (rx, ry) is at (2rx+1, 2ry+1)
+  const uint32_t rooms_x = (width - 1) / 2;
+  const uint32_t rooms_y = (height - 1) / 2;
+
+  uint32_t* stack = malloc((size_t)rooms_x * rooms_y * sizeof(*stack));
+  if (!stack)
+    exit(1);
+
+  size_t top = 0;
+  stack[top++] = 0;
+  text[stride + 1] = ' ';
+
+  while (top) {
+    const uint32_t room = stack[top - 1];
+    const uint32_t rx = room % rooms_x;
+    const uint32_t ry = room / rooms_x;
+
+    // Pick a random unvisited neighbour room
+    uint32_t next[4];
+    int num_next = 0;
+    if (ry > 0 && text[stride * (2 * ry - 1) + 2 * rx + 1] == '#')
+      next[num_next++] = room - rooms_x;
+    if (ry + 1 < rooms_y && text[stride * (2 * ry + 3) + 2 * rx + 1] == '#')
+      next[num_next++] = room + rooms_x;
+    if (rx + 1 < rooms_x && text[stride * (2 * ry + 1) + 2 * rx + 3] == '#')
+      next[num_next++] = room + 1;
+    if (rx > 0 && text[stride * (2 * ry + 1) + 2 * rx - 1] == '#')
+      next[num_next++] = room - 1;
+
+    if (!num_next) {
+      top--;
+      continue;
+    }
+
+    const uint32_t pick = next[rand() % num_next];
+    const size_t nx = 2 * (pick % rooms_x) + 1;
+    const size_t ny = 2 * (pick / rooms_x) + 1;
+
+    // Carve the new room and the wall between the two rooms
+    text[stride * ny + nx] = ' ';
+    text[stride * ((ny + 2 * ry + 1) / 2) + (nx + 2 * rx + 1) / 2] = ' ';
+    stack[top++] = pick;
+  }
+
+  free(stack);
+
+  // Knock out some of the walls between rooms
+  for (size_t y = 1; y + 1 < height; y++)
+    for (size_t x = 1 + y % 2; x + 1 < width; x += 2)
+      if (text[stride * y + x] == '#' && rand() % 100 < loops)
+        text[stride * y + x] = ' ';
+
+  if (!maze_load(maze, text, stride * height))
+    exit(1);
+
+  free(text);
+}
@@ -244,7 +244,7 @@ bheap_update(struct bheap* bheap, struct pathloc* node)
 struct path*
 path_find(const struct maze* maze, struct location source, struct location dest)
 {
-  struct path* ret_path = calloc(1, sizeof(*ret_path));
+  struct path* ret_path = path_new(0);
   if (!ret_path) exit(1);
 
   // target is the pathloc of the target vertex
@@ -337,7 +337,7 @@ path_find(const struct maze* maze, struct location source, struct location dest)
   if (target) {
     ret_path->next = 0;
     ret_path->num_steps = maze->maze_width * maze->maze_height;
-    ret_path->steps = calloc(ret_path->num_steps, sizeof(*ret_path->steps));
+    ret_path->steps = pool_get_steps(ret_path->num_steps);
 
     enum direction* stack;
     stack = calloc(maze->maze_width * maze->maze_height, sizeof(*stack));
@@ -360,7 +360,7 @@ path_find(const struct maze* maze, struct location source, struct location dest)
 
     ret_path->next = 0;
   } else {
-    free(ret_path);
+    path_delete(ret_path);
     ret_path = NULL;
   }
 
@@ -77,7 +77,7 @@ struct queue
 struct path*
 path_find(const struct maze* maze, struct location source, struct location dest)
 {
-  struct path* ret_path = calloc(1, sizeof(*ret_path));
+  struct path* ret_path = path_new(0);
   if (!ret_path)
     exit(1);
 
@@ -217,7 +217,7 @@ path_find(const struct maze* maze, struct location source, struct location dest)
 
   ret_path->next = 0;
   ret_path->num_steps = maze->maze_width * maze->maze_height;
-  ret_path->steps = calloc(ret_path->num_steps, sizeof(*ret_path->steps));
+  ret_path->steps = pool_get_steps(ret_path->num_steps);
 
   // Find the path.
   // We're essentially back tracing thru the path.
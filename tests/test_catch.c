@@ -0,0 +1,78 @@
+#include "game.h"  // for game, game_new_shared, game_tick, maze_load
+#include "path.h"  // for path_new, path_delete
+#include "troll.h" // for trolls
+
+#include <stdio.h>
+#include <string.h>
+
+// Play one tick of a troll and the player in a corridor and check whether the
+// player is caught:
+//  - a troll stepping onto the player that stands still
+//  - a troll and the player swapping cells, passing through each other
+//  - a troll stepping away from the player that steps onto its cell
+//  - a troll following the player onto the cell it left
+
+static const char* corridor = "#########\n"
+                              "#       #\n"
+                              "#########\n";
+
+int main(void);
+
+// Returns the state of the game after a tick with the troll at (troll_x)
+// stepping (troll_dir) and the player at (player_x) pressing (key)
+static enum game_state
+play(const struct maze* maze, uint32_t troll_x, enum direction troll_dir,
+     uint32_t player_x, int32_t key)
+{
+  struct game* game = game_new_shared(maze, 1);
+  game_set_trolls(game, 1);
+
+  struct trolls* trolls = &game->trolls;
+  const struct location troll = {.x = troll_x, .y = 1 };
+  occupancy_move(&trolls->occupancy, trolls->loc[0], troll);
+  trolls->loc[0] = troll;
+  trolls->face[0] = troll_dir;
+
+  path_delete(trolls->path[0]);
+  trolls->path[0] = path_new(1);
+  trolls->path[0]->steps[0] = troll_dir;
+
+  game->player->loc = (struct location){.x = player_x, .y = 1 };
+  game->player->face = key == 'd' ? EAST : WEST;
+
+  game_tick(game, key);
+
+  const enum game_state state = game->state;
+  game_delete(game);
+
+  return state;
+}
+
+static int
+check(const char* what, enum game_state state, enum game_state expected)
+{
+  printf("%-44s %s\n", what, state == expected ? "ok" : "WRONG");
+  return state == expected;
+}
+
+int
+main(void)
+{
+  struct maze maze;
+  if (maze_load(&maze, corridor, strlen(corridor)) != 1)
+    return 1;
+
+  int ok = 1;
+  ok &= check("troll steps onto the player",
+              play(&maze, 4, WEST, 3, 'x'), GAME_LOSE);
+  ok &= check("troll and player swap cells",
+              play(&maze, 4, WEST, 3, 'd'), GAME_LOSE);
+  ok &= check("player steps onto the cell the troll left",
+              play(&maze, 4, EAST, 3, 'd'), GAME_NONE);
+  ok &= check("troll steps onto the cell the player left",
+              play(&maze, 2, EAST, 3, 'd'), GAME_NONE);
+
+  maze_destroy(&maze);
+
+  return ok ? 0 : 1;
+}